@@ -0,0 +1,464 @@
+/*
+Benchmarks for cstring_array and cstring_array_aligned over synthetic corpora.
+
+Each corpus is generated from a fixed seed, so runs are comparable across machines and
+commits. Every benchmark is split into setup, run and teardown, and only run is timed;
+it's repeated until --min-time seconds have been spent in it. Results are reported as
+ns per string, MB/s of corpus text and the process's peak RSS so far (use --filter to
+run a single benchmark when the peak of that benchmark alone matters).
+
+Usage: bench [--format=console|json|csv] [--seed=N] [--bytes=N] [--min-time=SECONDS] [--filter=SUBSTRING]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "cstring_array.h"
+#include "cstring_array_aligned.h"
+
+#define BENCH_DEFAULT_SEED 42
+#define BENCH_DEFAULT_BYTES (8 * 1024 * 1024)
+#define BENCH_DEFAULT_MIN_TIME 0.25
+
+#define BENCH_ZIPF_VOCABULARY 8192
+#define BENCH_ZIPF_EXPONENT 1.07
+
+typedef enum {
+    BENCH_FORMAT_CONSOLE,
+    BENCH_FORMAT_JSON,
+    BENCH_FORMAT_CSV
+} bench_format;
+
+typedef struct {
+    const char *name;
+    // Tokens joined by separator, NUL-terminated
+    char *data;
+    size_t len;
+    char separator;
+    // The same tokens, each NUL-terminated, back to back
+    char *packed;
+    size_t packed_len;
+    char **tokens;
+    size_t num_tokens;
+} bench_corpus;
+
+/*
+xorshift64*: fast, and identical on every platform for a given seed, which rand()
+isn't.
+*/
+static uint64_t bench_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t bench_random_range(uint64_t *state, size_t lo, size_t hi) {
+    return lo + (size_t)(bench_random(state) % (hi - lo + 1));
+}
+
+static double bench_random_double(uint64_t *state) {
+    return (double)(bench_random(state) >> 11) / (double)(1ULL << 53);
+}
+
+static bool bench_corpus_init(bench_corpus *corpus, const char *name, char separator, size_t max_bytes) {
+    corpus->name = name;
+    corpus->separator = separator;
+    corpus->len = 0;
+    corpus->packed_len = 0;
+    corpus->num_tokens = 0;
+    corpus->data = malloc(max_bytes + 1);
+    corpus->packed = malloc(max_bytes + 1);
+    // Every token takes at least 2 bytes with its separator
+    corpus->tokens = malloc((max_bytes / 2 + 1) * sizeof(char *));
+    return corpus->data != NULL && corpus->packed != NULL && corpus->tokens != NULL;
+}
+
+static void bench_corpus_destroy(bench_corpus *corpus) {
+    free(corpus->data);
+    free(corpus->packed);
+    free(corpus->tokens);
+}
+
+// Returns false once the token doesn't fit in max_bytes
+static bool bench_corpus_add_token(bench_corpus *corpus, const char *token, size_t len, size_t max_bytes) {
+    size_t sep_len = corpus->len > 0 ? 1 : 0;
+    if (corpus->len + sep_len + len > max_bytes) return false;
+    if (sep_len) {
+        corpus->data[corpus->len++] = corpus->separator;
+    }
+    memcpy(corpus->data + corpus->len, token, len);
+    corpus->len += len;
+    corpus->data[corpus->len] = '\0';
+
+    corpus->tokens[corpus->num_tokens++] = corpus->packed + corpus->packed_len;
+    memcpy(corpus->packed + corpus->packed_len, token, len);
+    corpus->packed_len += len;
+    corpus->packed[corpus->packed_len++] = '\0';
+    return true;
+}
+
+// Words of 1-8 lowercase letters, space-separated
+static bool bench_corpus_short_tokens(bench_corpus *corpus, uint64_t seed, size_t max_bytes) {
+    if (!bench_corpus_init(corpus, "short_tokens", ' ', max_bytes)) return false;
+    uint64_t state = seed;
+    char token[8];
+    for (;;) {
+        size_t len = bench_random_range(&state, 1, sizeof(token));
+        for (size_t i = 0; i < len; i++) {
+            token[i] = (char)('a' + bench_random(&state) % 26);
+        }
+        if (!bench_corpus_add_token(corpus, token, len, max_bytes)) break;
+    }
+    return true;
+}
+
+// Printable lines of 256-4096 bytes, newline-separated
+static bool bench_corpus_long_lines(bench_corpus *corpus, uint64_t seed, size_t max_bytes) {
+    if (!bench_corpus_init(corpus, "long_lines", '\n', max_bytes)) return false;
+    uint64_t state = seed;
+    char line[4096];
+    for (;;) {
+        size_t len = bench_random_range(&state, 256, sizeof(line));
+        for (size_t i = 0; i < len; i++) {
+            line[i] = (char)(' ' + bench_random(&state) % 95);
+        }
+        if (!bench_corpus_add_token(corpus, line, len, max_bytes)) break;
+    }
+    return true;
+}
+
+/*
+Words drawn from a fixed vocabulary with Zipfian frequencies, like natural-language
+text: a handful of words make up most of the corpus.
+*/
+static bool bench_corpus_zipf(bench_corpus *corpus, uint64_t seed, size_t max_bytes) {
+    if (!bench_corpus_init(corpus, "zipf", ' ', max_bytes)) return false;
+    uint64_t state = seed;
+
+    static char words[BENCH_ZIPF_VOCABULARY][12];
+    static size_t word_lengths[BENCH_ZIPF_VOCABULARY];
+    static double cdf[BENCH_ZIPF_VOCABULARY];
+    double total = 0.0;
+    for (size_t i = 0; i < BENCH_ZIPF_VOCABULARY; i++) {
+        word_lengths[i] = bench_random_range(&state, 2, sizeof(words[i]));
+        for (size_t j = 0; j < word_lengths[i]; j++) {
+            words[i][j] = (char)('a' + bench_random(&state) % 26);
+        }
+        total += 1.0 / pow((double)(i + 1), BENCH_ZIPF_EXPONENT);
+        cdf[i] = total;
+    }
+
+    for (;;) {
+        double u = bench_random_double(&state) * total;
+        size_t lo = 0, hi = BENCH_ZIPF_VOCABULARY - 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (!bench_corpus_add_token(corpus, words[lo], word_lengths[lo], max_bytes)) break;
+    }
+    return true;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static long bench_peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+typedef struct {
+    const bench_corpus *corpus;
+    // Built once per corpus and variant, for the benchmarks that need an existing array
+    void *source;
+    void *array;
+    void *buffer;
+} bench_context;
+
+typedef struct {
+    const char *name;
+    void (*setup)(bench_context *ctx);
+    void (*run)(bench_context *ctx);
+    void (*teardown)(bench_context *ctx);
+} bench_benchmark;
+
+typedef struct {
+    const char *variant;
+    void *(*new_source)(const bench_corpus *corpus);
+    void (*destroy)(void *array);
+    const bench_benchmark *benchmarks;
+    size_t num_benchmarks;
+} bench_variant;
+
+static void bench_nop(bench_context *ctx) {
+    (void)ctx;
+}
+
+/*
+Defines the benchmarks for one cstring_array instantiation. They're the same for every
+variant, so they're generated rather than written out twice.
+*/
+#define BENCH_VARIANT(ARRAY, CHARS)                                                         \
+static void *ARRAY##_bench_new_source(const bench_corpus *corpus) {                         \
+    size_t count;                                                                           \
+    return ARRAY##_split(corpus->data, &corpus->separator, 1, &count);                      \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_destroy(void *array) {                                            \
+    ARRAY##_destroy(array);                                                                 \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_destroy_array(bench_context *ctx) {                               \
+    ARRAY##_destroy(ctx->array);                                                            \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_setup_new(bench_context *ctx) {                                   \
+    ctx->array = ARRAY##_new();                                                             \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_add_string(bench_context *ctx) {                                  \
+    ARRAY *array = ctx->array;                                                              \
+    for (size_t i = 0; i < ctx->corpus->num_tokens; i++) {                                  \
+        ARRAY##_add_string(array, ctx->corpus->tokens[i]);                                  \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_split(bench_context *ctx) {                                       \
+    size_t count;                                                                           \
+    ctx->array = ARRAY##_split(ctx->corpus->data, &ctx->corpus->separator, 1, &count);      \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_setup_split_no_copy(bench_context *ctx) {                         \
+    ctx->buffer = malloc(ctx->corpus->len + 1);                                             \
+    memcpy(ctx->buffer, ctx->corpus->data, ctx->corpus->len + 1);                           \
+}                                                                                           \
+                                                                                            \
+/* The array takes ownership of the buffer */                                               \
+static void ARRAY##_bench_split_no_copy(bench_context *ctx) {                               \
+    size_t count;                                                                           \
+    ctx->array = ARRAY##_split_no_copy(ctx->buffer, ctx->corpus->separator, &count);        \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_setup_from_char_array(bench_context *ctx) {                       \
+    CHARS *chars = CHARS##_new_size(ctx->corpus->packed_len + 1);                           \
+    CHARS##_append_len(chars, ctx->corpus->packed, ctx->corpus->packed_len);                \
+    ctx->buffer = chars;                                                                    \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_from_char_array(bench_context *ctx) {                             \
+    ctx->array = ARRAY##_from_char_array(ctx->buffer);                                      \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_extend(bench_context *ctx) {                                      \
+    ARRAY##_extend(ctx->array, ctx->source);                                                \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_setup_to_strings(bench_context *ctx) {                            \
+    ctx->array = ARRAY##_new();                                                             \
+    ARRAY##_extend(ctx->array, ctx->source);                                                \
+}                                                                                           \
+                                                                                            \
+/* to_strings consumes the array */                                                         \
+static void ARRAY##_bench_to_strings(bench_context *ctx) {                                  \
+    ctx->buffer = ARRAY##_to_strings(ctx->array);                                           \
+}                                                                                           \
+                                                                                            \
+static void ARRAY##_bench_teardown_to_strings(bench_context *ctx) {                         \
+    char **strings = ctx->buffer;                                                           \
+    for (size_t i = 0; i < ctx->corpus->num_tokens; i++) {                                  \
+        free(strings[i]);                                                                   \
+    }                                                                                       \
+    free(strings);                                                                          \
+}                                                                                           \
+                                                                                            \
+static const bench_benchmark ARRAY##_benchmarks[] = {                                       \
+    {"add_string", ARRAY##_bench_setup_new, ARRAY##_bench_add_string,                       \
+        ARRAY##_bench_destroy_array},                                                       \
+    {"split", bench_nop, ARRAY##_bench_split, ARRAY##_bench_destroy_array},                 \
+    {"split_no_copy", ARRAY##_bench_setup_split_no_copy, ARRAY##_bench_split_no_copy,       \
+        ARRAY##_bench_destroy_array},                                                       \
+    {"from_char_array", ARRAY##_bench_setup_from_char_array,                                \
+        ARRAY##_bench_from_char_array, ARRAY##_bench_destroy_array},                        \
+    {"extend", ARRAY##_bench_setup_new, ARRAY##_bench_extend,                               \
+        ARRAY##_bench_destroy_array},                                                       \
+    {"to_strings", ARRAY##_bench_setup_to_strings, ARRAY##_bench_to_strings,                \
+        ARRAY##_bench_teardown_to_strings},                                                 \
+};
+
+BENCH_VARIANT(cstring_array, char_array)
+BENCH_VARIANT(cstring_array_aligned, char_array_aligned)
+
+#define BENCH_NUM_BENCHMARKS (sizeof(cstring_array_benchmarks) / sizeof(cstring_array_benchmarks[0]))
+
+static const bench_variant bench_variants[] = {
+    {"cstring_array", cstring_array_bench_new_source, cstring_array_bench_destroy,
+        cstring_array_benchmarks, BENCH_NUM_BENCHMARKS},
+    {"cstring_array_aligned", cstring_array_aligned_bench_new_source, cstring_array_aligned_bench_destroy,
+        cstring_array_aligned_benchmarks, BENCH_NUM_BENCHMARKS},
+};
+
+typedef struct {
+    size_t iterations;
+    double ns_per_string;
+    double mb_per_s;
+    long peak_rss_kb;
+} bench_result;
+
+static bench_result bench_measure(const bench_benchmark *benchmark, bench_context *ctx, double min_time) {
+    uint64_t min_ns = (uint64_t)(min_time * 1e9);
+    uint64_t elapsed = 0;
+    size_t iterations = 0;
+    while (iterations == 0 || elapsed < min_ns) {
+        benchmark->setup(ctx);
+        uint64_t start = bench_now_ns();
+        benchmark->run(ctx);
+        elapsed += bench_now_ns() - start;
+        benchmark->teardown(ctx);
+        iterations++;
+    }
+
+    const bench_corpus *corpus = ctx->corpus;
+    bench_result result;
+    result.iterations = iterations;
+    result.ns_per_string = (double)elapsed / ((double)iterations * (double)(corpus->num_tokens > 0 ? corpus->num_tokens : 1));
+    result.mb_per_s = ((double)corpus->len * (double)iterations / (1024.0 * 1024.0)) / ((double)elapsed / 1e9);
+    result.peak_rss_kb = bench_peak_rss_kb();
+    return result;
+}
+
+static void bench_report(bench_format format, bool first, const char *variant, const char *benchmark, const bench_corpus *corpus, bench_result result) {
+    switch (format) {
+        case BENCH_FORMAT_JSON:
+            printf("%s\n    {\"variant\": \"%s\", \"benchmark\": \"%s\", \"corpus\": \"%s\", \"strings\": %zu, \"bytes\": %zu, "
+                   "\"iterations\": %zu, \"ns_per_string\": %.3f, \"mb_per_s\": %.3f, \"peak_rss_kb\": %ld}",
+                   first ? "" : ",", variant, benchmark, corpus->name, corpus->num_tokens, corpus->len,
+                   result.iterations, result.ns_per_string, result.mb_per_s, result.peak_rss_kb);
+            break;
+        case BENCH_FORMAT_CSV:
+            printf("%s,%s,%s,%zu,%zu,%zu,%.3f,%.3f,%ld\n", variant, benchmark, corpus->name, corpus->num_tokens,
+                   corpus->len, result.iterations, result.ns_per_string, result.mb_per_s, result.peak_rss_kb);
+            break;
+        default: {
+            char name[128];
+            snprintf(name, sizeof(name), "%s/%s/%s", variant, benchmark, corpus->name);
+            printf("%-52s %10zu %12.2f %12.2f %12ld\n", name, result.iterations, result.ns_per_string,
+                   result.mb_per_s, result.peak_rss_kb);
+            break;
+        }
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--format=console|json|csv] [--seed=N] [--bytes=N] [--min-time=SECONDS] [--filter=SUBSTRING]\n", program);
+}
+
+int main(int argc, char **argv) {
+    bench_format format = BENCH_FORMAT_CONSOLE;
+    uint64_t seed = BENCH_DEFAULT_SEED;
+    size_t max_bytes = BENCH_DEFAULT_BYTES;
+    double min_time = BENCH_DEFAULT_MIN_TIME;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--format=console") == 0) {
+            format = BENCH_FORMAT_CONSOLE;
+        } else if (strcmp(arg, "--format=json") == 0 || strcmp(arg, "--json") == 0) {
+            format = BENCH_FORMAT_JSON;
+        } else if (strcmp(arg, "--format=csv") == 0 || strcmp(arg, "--csv") == 0) {
+            format = BENCH_FORMAT_CSV;
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            seed = strtoull(arg + 7, NULL, 10);
+        } else if (strncmp(arg, "--bytes=", 8) == 0) {
+            max_bytes = strtoull(arg + 8, NULL, 10);
+        } else if (strncmp(arg, "--min-time=", 11) == 0) {
+            min_time = strtod(arg + 11, NULL);
+        } else if (strncmp(arg, "--filter=", 9) == 0) {
+            filter = arg + 9;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    // xorshift gets stuck at 0
+    if (seed == 0) seed = BENCH_DEFAULT_SEED;
+
+    bench_corpus corpora[3];
+    bool ok = bench_corpus_short_tokens(&corpora[0], seed, max_bytes)
+        && bench_corpus_long_lines(&corpora[1], seed, max_bytes)
+        && bench_corpus_zipf(&corpora[2], seed, max_bytes);
+    if (!ok) {
+        fprintf(stderr, "Could not allocate a %zu byte corpus\n", max_bytes);
+        return 1;
+    }
+    size_t num_corpora = sizeof(corpora) / sizeof(corpora[0]);
+
+    switch (format) {
+        case BENCH_FORMAT_JSON:
+            printf("{\n  \"context\": {\"seed\": %llu, \"bytes\": %zu, \"min_time\": %.3f},\n  \"benchmarks\": [",
+                   (unsigned long long)seed, max_bytes, min_time);
+            break;
+        case BENCH_FORMAT_CSV:
+            printf("variant,benchmark,corpus,strings,bytes,iterations,ns_per_string,mb_per_s,peak_rss_kb\n");
+            break;
+        default:
+            printf("%-52s %10s %12s %12s %12s\n", "Benchmark", "Iterations", "ns/string", "MB/s", "Peak RSS KB");
+            break;
+    }
+
+    bool first = true;
+    for (size_t v = 0; v < sizeof(bench_variants) / sizeof(bench_variants[0]); v++) {
+        const bench_variant *variant = &bench_variants[v];
+        for (size_t c = 0; c < num_corpora; c++) {
+            bench_context ctx = {&corpora[c], NULL, NULL, NULL};
+            ctx.source = variant->new_source(&corpora[c]);
+            if (ctx.source == NULL) {
+                fprintf(stderr, "Could not split corpus %s\n", corpora[c].name);
+                return 1;
+            }
+            for (size_t b = 0; b < variant->num_benchmarks; b++) {
+                const bench_benchmark *benchmark = &variant->benchmarks[b];
+                char name[128];
+                snprintf(name, sizeof(name), "%s/%s/%s", variant->variant, benchmark->name, corpora[c].name);
+                if (filter != NULL && strstr(name, filter) == NULL) continue;
+
+                bench_result result = bench_measure(benchmark, &ctx, min_time);
+                bench_report(format, first, variant->variant, benchmark->name, &corpora[c], result);
+                first = false;
+                fflush(stdout);
+            }
+            variant->destroy(ctx.source);
+        }
+    }
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("\n  ]\n}\n");
+    }
+
+    for (size_t c = 0; c < num_corpora; c++) {
+        bench_corpus_destroy(&corpora[c]);
+    }
+    return 0;
+}
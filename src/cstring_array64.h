@@ -0,0 +1,8 @@
+#ifndef CSTRING_ARRAY64_H
+#define CSTRING_ARRAY64_H
+
+#define CSTRING_ARRAY_64
+#include "cstring_array_base.h"
+#undef CSTRING_ARRAY_64
+
+#endif
@@ -9,8 +9,13 @@ array->str = {'f', 'o', 'o', '\0', 'b', 'a', 'r', '\0', 'b', 'a', 'z', '\0'};
 Each value in array->indices is the start position of a token in array->str. Each string
 is NUL-terminated, so array->str->a + 4 is "bar", a valid NUL-terminated C string
 
+One more offset past the last one, array->indices->a[array->indices->n], marks the end of
+the last string (12 above), so every length is read off the offsets.
+
 array->str is a char_array, so all of the functions from char_array like char_array_cat_printf
-can be used when building the contiguous string arrays as well.
+can be used when building the contiguous string arrays as well. That end offset isn't updated
+by them though: call cstring_array_update_end after writing to array->str directly, before
+any other cstring_array function, or the last string's length will be stale.
 */
 
 #ifndef CSTRING_ARRAY_BASE_H
@@ -22,287 +27,3336 @@ can be used when building the contiguous string arrays as well.
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#define CSTRING_ARRAY_HAVE_MMAP
+#define CSTRING_ARRAY_HAVE_UNISTD
+#endif
 
-#define INVALID_INDEX(i, n) ((i) < 0 || (i) >= (n))
-
+#if !defined(CSTRING_ARRAY_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#include <pthread.h>
+#define CSTRING_ARRAY_HAVE_THREADS
 #endif
 
-#ifdef CSTRING_ARRAY_ALIGNED
-#define CSTRING_ARRAY_NAME cstring_array_aligned
-#include "char_array/char_array_aligned.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CSTRING_ARRAY_SSE2
+#endif
 
-#define CHAR_ARRAY_NAME char_array_aligned
+#define INVALID_INDEX(i, n) ((i) < 0 || (i) >= (n))
 
-#define INDEX_ARRAY_NAME index_array_aligned
-#define ARRAY_NAME index_array_aligned
-#define ARRAY_TYPE uint32_t
-#include "aligned_array/aligned_array.h"
-#undef ARRAY_NAME
-#undef ARRAY_TYPE
+/*
+Boundary scanning works on 64-byte blocks. cstring_array_scan_mask64 returns a
+bitmask with bit j set when p[j] is either c1 or c2, the same shape as a movemask,
+so callers can walk the hits with count-trailing-zeros instead of testing each byte.
+*/
+#define CSTRING_ARRAY_SCAN_BLOCK 64
 
+static inline unsigned cstring_array_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
 #else
-#define CSTRING_ARRAY_NAME cstring_array
-#include "char_array/char_array.h"
+    unsigned n = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
 
-#define CHAR_ARRAY_NAME char_array
-#define INDEX_ARRAY_NAME index_array
-#define ARRAY_NAME index_array
-#define ARRAY_TYPE uint32_t
-#include "array/array.h"
-#undef ARRAY_NAME
-#undef ARRAY_TYPE
+static inline uint64_t cstring_array_swar_eq8(uint64_t w, uint64_t pattern) {
+    // High bit of each byte is set where the byte of w equals the byte of pattern, exactly
+    uint64_t x = w ^ pattern;
+    uint64_t t = (x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL;
+    return ~(t | x | 0x7F7F7F7F7F7F7F7FULL);
+}
 
+// Reads all 64 bytes at p, which must be in bounds; cstring_array_scan_mask_tail handles shorter tails
+static inline uint64_t cstring_array_scan_mask64(const char *p, char c1, char c2) {
+#if defined(__AVX2__)
+    __m256i v1 = _mm256_set1_epi8(c1);
+    __m256i v2 = _mm256_set1_epi8(c2);
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+    uint32_t m_lo = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(lo, v1), _mm256_cmpeq_epi8(lo, v2)));
+    uint32_t m_hi = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(hi, v1), _mm256_cmpeq_epi8(hi, v2)));
+    return (uint64_t)m_lo | ((uint64_t)m_hi << 32);
+#elif defined(CSTRING_ARRAY_SSE2)
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    uint64_t mask = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        uint64_t m = (uint16_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)));
+        mask |= m << (16 * k);
+    }
+    return mask;
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t p1 = 0x0101010101010101ULL * (uint8_t)c1;
+    uint64_t p2 = 0x0101010101010101ULL * (uint8_t)c2;
+    uint64_t mask = 0;
+    for (int k = 0; k < 8; k++) {
+        uint64_t w;
+        memcpy(&w, p + 8 * k, sizeof(w));
+        uint64_t hits = cstring_array_swar_eq8(w, p1) | cstring_array_swar_eq8(w, p2);
+        // Gather the high bit of each byte into the top byte
+        uint64_t m = ((hits >> 7) * 0x0102040810204080ULL) >> 56;
+        mask |= m << (8 * k);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int j = 0; j < CSTRING_ARRAY_SCAN_BLOCK; j++) {
+        if (p[j] == c1 || p[j] == c2) mask |= 1ULL << j;
+    }
+    return mask;
 #endif
+}
 
-typedef struct {
-    INDEX_ARRAY_NAME *indices;
-    CHAR_ARRAY_NAME *str;
-} CSTRING_ARRAY_NAME;
+#if defined(__GNUC__) || defined(__clang__)
+#define CSTRING_ARRAY_NOINLINE __attribute__((noinline))
+#else
+#define CSTRING_ARRAY_NOINLINE
+#endif
 
-#define CONCAT_(a, b) a ## b
-#define CONCAT(a, b) CONCAT_(a, b)
-#define CSTRING_ARRAY_FUNC(func) CONCAT(CSTRING_ARRAY_NAME, _##func)
-#define CHAR_ARRAY_FUNC(func) CONCAT(CHAR_ARRAY_NAME, _##func)
-#define INDEX_ARRAY_FUNC(func) CONCAT(INDEX_ARRAY_NAME, _##func)
+/*
+scan_mask64 over a tail of len < 64 bytes, reading nothing past p + len: the tail is
+copied into a local block first, and hits in its padding are masked off. Block loops
+call scan_mask64 for their full blocks and this for the last, partial one, out of line
+as it's the rare case.
+*/
+static CSTRING_ARRAY_NOINLINE uint64_t cstring_array_scan_mask_tail(const char *p, size_t len, char c1, char c2) {
+    if (len == 0) return 0;
+    char block[CSTRING_ARRAY_SCAN_BLOCK] = {0};
+    memcpy(block, p, len);
+    return cstring_array_scan_mask64(block, c1, c2) & (~0ULL >> (CSTRING_ARRAY_SCAN_BLOCK - len));
+}
 
+static inline uint64_t cstring_array_rotl64(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
 
-static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(new)(void) {
-    CSTRING_ARRAY_NAME *array = malloc(sizeof(CSTRING_ARRAY_NAME));
-    if (array == NULL) return NULL;
+static inline uint64_t cstring_array_mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
-    array->indices = INDEX_ARRAY_FUNC(new)();
-    if (array->indices == NULL) {
-        free(array);
-        return NULL;
-    }
+static inline uint64_t cstring_array_hash_word(uint64_t w) {
+    return cstring_array_rotl64(w * 0x87C37B91114253D5ULL, 31) * 0x4CF5AD432745937FULL;
+}
 
-    array->str = CHAR_ARRAY_FUNC(new)();
-    if (array->str == NULL) {
-        INDEX_ARRAY_FUNC(destroy)(array->indices);
-        free(array);
-        return NULL;
+static inline uint64_t cstring_array_hash_round(uint64_t h, uint64_t w) {
+    return cstring_array_rotl64(h ^ cstring_array_hash_word(w), 27) * 5 + 0x52DCE729;
+}
+
+// Word-at-a-time 64-bit hash, used for file checksums and hash tables
+static uint64_t cstring_array_hash(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = seed ^ ((uint64_t)len * 0x9E3779B97F4A7C15ULL);
+
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        h = cstring_array_hash_round(h, w);
+    }
+    if (len > 0) {
+        uint64_t w = 0;
+        memcpy(&w, p, len);
+        h ^= cstring_array_hash_word(w);
     }
+    return cstring_array_mix64(h);
+}
 
-    return array;
+/*
+cstring_array_hash fed in pieces: the total length has to be known up front, and
+the pieces hash the same as one call over their concatenation.
+*/
+typedef struct {
+    uint64_t h;
+    unsigned char tail[8];
+    size_t tail_len;
+} cstring_array_hasher;
+
+static inline void cstring_array_hasher_init(cstring_array_hasher *self, size_t len, uint64_t seed) {
+    self->h = seed ^ ((uint64_t)len * 0x9E3779B97F4A7C15ULL);
+    self->tail_len = 0;
 }
 
-static void CSTRING_ARRAY_FUNC(destroy)(CSTRING_ARRAY_NAME *self) {
-    if (self == NULL) return;
-    if (self->indices) {
-        INDEX_ARRAY_FUNC(destroy)(self->indices);
-    }
-    if (self->str) {
-        CHAR_ARRAY_FUNC(destroy)(self->str);
+static void cstring_array_hasher_update(cstring_array_hasher *self, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    while (len > 0) {
+        if (self->tail_len == 0 && len >= 8) {
+            uint64_t w;
+            memcpy(&w, p, sizeof(w));
+            self->h = cstring_array_hash_round(self->h, w);
+            p += 8;
+            len -= 8;
+            continue;
+        }
+        size_t take = 8 - self->tail_len < len ? 8 - self->tail_len : len;
+        memcpy(self->tail + self->tail_len, p, take);
+        self->tail_len += take;
+        p += take;
+        len -= take;
+        if (self->tail_len == 8) {
+            self->tail_len = 0;
+            uint64_t w;
+            memcpy(&w, self->tail, sizeof(w));
+            self->h = cstring_array_hash_round(self->h, w);
+        }
     }
-    free(self);
 }
 
-static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(new_size)(size_t size) {
-    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
-    CHAR_ARRAY_FUNC(resize)(array->str, size);
-    return array;
+static inline uint64_t cstring_array_hasher_final(cstring_array_hasher *self) {
+    uint64_t h = self->h;
+    if (self->tail_len > 0) {
+        uint64_t w = 0;
+        memcpy(&w, self->tail, self->tail_len);
+        h ^= cstring_array_hash_word(w);
+    }
+    return cstring_array_mix64(h);
 }
 
-static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(from_char_array)(CHAR_ARRAY_NAME *str) {
-    if (str == NULL) return NULL;
-    if (str->n == 0)
-        return CSTRING_ARRAY_FUNC(new)();
+/*
+On-disk format written by cstring_array_save and mapped by cstring_array_mmap_open:
 
-    CSTRING_ARRAY_NAME *array = malloc(sizeof(CSTRING_ARRAY_NAME));
-    if (array == NULL) return NULL;
+    header (64 bytes)
+    offsets: num_strings + 1 offsets of offset_size bytes, the last being str_size
+    str: str_size bytes of NUL-delimited strings, followed by at least one NUL byte
 
-    array->str = str;
-    array->indices = INDEX_ARRAY_FUNC(new_size)(1);
+Both sections start on a 64-byte boundary so the mapped offsets and pool satisfy
+the aligned variant's alignment. Integers are stored in native byte order, which
+byte_order_mark records so files from a machine of the other endianness are rejected.
+The checksum chains cstring_array_hash over the num_strings offsets, the end offset
+and the str section, in that order.
+*/
+#define CSTRING_ARRAY_FILE_MAGIC "CSTRARR"
+#define CSTRING_ARRAY_FILE_VERSION 1
+#define CSTRING_ARRAY_FILE_BYTE_ORDER_MARK 0x01020304
+#define CSTRING_ARRAY_FILE_ALIGNMENT 64
 
-    INDEX_ARRAY_FUNC(push)(array->indices, 0);
-    char *ptr = str->a;
-    for (uint32_t i = 0; i < str->n - 1; i++, ptr++) {
-        if (*ptr == '\0') {
-            INDEX_ARRAY_FUNC(push)(array->indices, i + 1);
-        }
-    }
-    return array;
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint32_t offset_size;
+    uint32_t reserved;
+    uint64_t num_strings;
+    uint64_t str_size;
+    uint64_t offsets_pos;
+    uint64_t str_pos;
+    uint64_t checksum;
+} cstring_array_file_header;
+
+static inline size_t cstring_array_file_padding(size_t pos) {
+    return (CSTRING_ARRAY_FILE_ALIGNMENT - pos % CSTRING_ARRAY_FILE_ALIGNMENT) % CSTRING_ARRAY_FILE_ALIGNMENT;
 }
 
-static inline size_t CSTRING_ARRAY_FUNC(num_strings)(CSTRING_ARRAY_NAME *self) {
-    if (self == NULL) return 0;
-    return self->indices->n;
+static bool cstring_array_file_write_padding(FILE *f, size_t padding) {
+    static const char zeros[CSTRING_ARRAY_FILE_ALIGNMENT] = {0};
+    return padding == 0 || fwrite(zeros, 1, padding, f) == padding;
 }
 
-static inline uint32_t CSTRING_ARRAY_FUNC(start_token)(CSTRING_ARRAY_NAME *self) {
-    uint32_t index = (uint32_t)self->str->n;
-    INDEX_ARRAY_FUNC(push)(self->indices, index);
-    return index;
+static inline bool cstring_array_file_write_hashed(FILE *f, cstring_array_hasher *hasher, const void *data, size_t size) {
+    cstring_array_hasher_update(hasher, data, size);
+    return size == 0 || fwrite(data, 1, size, f) == size;
 }
 
-static inline size_t CSTRING_ARRAY_FUNC(capacity)(CSTRING_ARRAY_NAME *self) {
-    return self->str->m;
+// Whether a proper prefix of separator is also a suffix, i.e. occurrences can overlap
+static bool cstring_array_separator_self_overlaps(const char *separator, size_t separator_len) {
+    for (size_t k = 1; k < separator_len; k++) {
+        if (memcmp(separator, separator + separator_len - k, k) == 0) return true;
+    }
+    return false;
 }
 
-static inline size_t CSTRING_ARRAY_FUNC(used)(CSTRING_ARRAY_NAME *self) {
-    return self->str->n;
+/*
+First occurrence of separator in str[0..len), or NULL. Multi-byte separators are found
+with a first/last byte filter: each vector compares block i against the separator's first
+byte and block i + separator_len - 1 against its last, and only positions where both
+match are verified with memcmp, so the cost stays close to a single-byte scan instead of
+a memcmp per position. Loads never go past str + len.
+*/
+static const char *cstring_array_find_separator(const char *str, size_t len, const char *separator, size_t separator_len) {
+    if (separator_len == 0 || len < separator_len) return NULL;
+    if (separator_len == 1) return memchr(str, separator[0], len);
+
+    size_t last = separator_len - 1;
+    // Candidate start positions are [0, len - last)
+    size_t num_starts = len - last;
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i first_byte = _mm256_set1_epi8(separator[0]);
+    __m256i last_byte = _mm256_set1_epi8(separator[last]);
+    for (; i + 32 <= num_starts; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(str + i + last));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first_byte), _mm256_cmpeq_epi8(b, last_byte)));
+        while (mask != 0) {
+            size_t j = i + cstring_array_ctz64(mask);
+            if (memcmp(str + j + 1, separator + 1, last - 1) == 0) return str + j;
+            mask &= mask - 1;
+        }
+    }
+#elif defined(CSTRING_ARRAY_SSE2)
+    __m128i first_byte = _mm_set1_epi8(separator[0]);
+    __m128i last_byte = _mm_set1_epi8(separator[last]);
+    for (; i + 16 <= num_starts; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(str + i + last));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first_byte), _mm_cmpeq_epi8(b, last_byte)));
+        while (mask != 0) {
+            size_t j = i + cstring_array_ctz64(mask);
+            if (memcmp(str + j + 1, separator + 1, last - 1) == 0) return str + j;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i < num_starts) {
+        const char *p = memchr(str + i, separator[0], num_starts - i);
+        if (p == NULL) return NULL;
+        if (p[last] == separator[last] && memcmp(p + 1, separator + 1, last - 1) == 0) return p;
+        i = (size_t)(p - str) + 1;
+    }
+    return NULL;
 }
 
-static inline void CSTRING_ARRAY_FUNC(terminate)(CSTRING_ARRAY_NAME *self) {
-    CHAR_ARRAY_FUNC(terminate)(self->str);
-}
+/*
+A cstring_array_separator describes what to split on: either one separator string, or a
+set of single bytes any of which is a separator (e.g. ",;\t"). Sets of up to
+CSTRING_ARRAY_SEPARATOR_MAX_CMP bytes are matched with one vector compare per byte.
+Larger ASCII sets use a nibble lookup under AVX2: a byte is in the set when
+lo_table[byte & 0xF] & hi_table[byte >> 4] is non-zero, which two shuffles check for 32
+bytes at once. Other sets fall back to a 256-entry table.
+*/
+#define CSTRING_ARRAY_SEPARATOR_MAX_CMP 4
 
-static inline uint32_t CSTRING_ARRAY_FUNC(add_string)(CSTRING_ARRAY_NAME *self, char *str) {
-    uint32_t index = CSTRING_ARRAY_FUNC(start_token)(self);
-    CHAR_ARRAY_FUNC(append)(self->str, str);
-    CHAR_ARRAY_FUNC(terminate)(self->str);
-    return index;
+typedef enum {
+    CSTRING_ARRAY_SEPARATOR_NONE,
+    CSTRING_ARRAY_SEPARATOR_STRING,
+    CSTRING_ARRAY_SEPARATOR_SET
+} cstring_array_separator_type;
+
+typedef struct {
+    cstring_array_separator_type type;
+    // Bytes consumed by one match
+    size_t match_len;
+    const char *separator;
+    size_t num_bytes;
+    char bytes[CSTRING_ARRAY_SEPARATOR_MAX_CMP];
+    bool ascii;
+    uint8_t lo_table[16];
+    uint8_t hi_table[16];
+    bool table[256];
+} cstring_array_separator;
+
+static inline void cstring_array_separator_init(cstring_array_separator *self, const char *separator, size_t separator_len) {
+    self->type = separator_len > 0 ? CSTRING_ARRAY_SEPARATOR_STRING : CSTRING_ARRAY_SEPARATOR_NONE;
+    self->separator = separator;
+    self->match_len = separator_len;
+    self->num_bytes = 0;
 }
 
-static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(from_strings)(char **strings, size_t n) {
-    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
-    for (size_t i = 0; i < n; i++) {
-        CSTRING_ARRAY_FUNC(add_string)(array, strings[i]);
+static void cstring_array_separator_init_set(cstring_array_separator *self, const char *set, size_t set_len) {
+    memset(self, 0, sizeof(cstring_array_separator));
+    self->ascii = true;
+    for (size_t i = 0; i < set_len; i++) {
+        uint8_t c = (uint8_t)set[i];
+        if (self->table[c]) continue;
+        self->table[c] = true;
+        if (self->num_bytes < CSTRING_ARRAY_SEPARATOR_MAX_CMP) {
+            self->bytes[self->num_bytes] = (char)c;
+        }
+        self->num_bytes++;
+        if (c >= 0x80) {
+            self->ascii = false;
+        } else {
+            self->lo_table[c & 0xF] |= (uint8_t)(1 << (c >> 4));
+        }
     }
-    return array;
+    for (int h = 0; h < 8; h++) {
+        self->hi_table[h] = (uint8_t)(1 << h);
+    }
+    if (self->num_bytes == 0) {
+        self->type = CSTRING_ARRAY_SEPARATOR_NONE;
+    } else if (self->num_bytes == 1) {
+        // A single-byte set is just that separator, read from bytes so the struct can be copied
+        self->type = CSTRING_ARRAY_SEPARATOR_STRING;
+    } else {
+        self->type = CSTRING_ARRAY_SEPARATOR_SET;
+    }
+    self->match_len = 1;
 }
 
+static inline const char *cstring_array_find_set(const cstring_array_separator *self, const char *str, size_t len) {
+    size_t i = 0;
+    if (self->num_bytes <= CSTRING_ARRAY_SEPARATOR_MAX_CMP) {
+#if defined(__AVX2__)
+        __m256i b[CSTRING_ARRAY_SEPARATOR_MAX_CMP];
+        for (size_t k = 0; k < self->num_bytes; k++) {
+            b[k] = _mm256_set1_epi8(self->bytes[k]);
+        }
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+            __m256i hits = _mm256_cmpeq_epi8(v, b[0]);
+            for (size_t k = 1; k < self->num_bytes; k++) {
+                hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, b[k]));
+            }
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+            if (mask != 0) return str + i + cstring_array_ctz64(mask);
+        }
+#elif defined(CSTRING_ARRAY_SSE2)
+        __m128i b[CSTRING_ARRAY_SEPARATOR_MAX_CMP];
+        for (size_t k = 0; k < self->num_bytes; k++) {
+            b[k] = _mm_set1_epi8(self->bytes[k]);
+        }
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+            __m128i hits = _mm_cmpeq_epi8(v, b[0]);
+            for (size_t k = 1; k < self->num_bytes; k++) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, b[k]));
+            }
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(hits);
+            if (mask != 0) return str + i + cstring_array_ctz64(mask);
+        }
+#endif
+    }
+#if defined(__AVX2__)
+    else if (self->ascii) {
+        __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)self->lo_table));
+        __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)self->hi_table));
+        __m256i nibble = _mm256_set1_epi8(0x0F);
+        __m256i zero = _mm256_setzero_si256();
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+            __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble));
+            __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero));
+            if (mask != 0) return str + i + cstring_array_ctz64(mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (self->table[(uint8_t)str[i]]) return str + i;
+    }
+    return NULL;
+}
 
-static inline int32_t CSTRING_ARRAY_FUNC(get_offset)(CSTRING_ARRAY_NAME *self, uint32_t i) {
-    if (INVALID_INDEX(i, self->indices->n)) {
-        return -1;
+// First match of self in str[0..len), or NULL. Each match is self->match_len bytes.
+static inline const char *cstring_array_separator_find(const cstring_array_separator *self, const char *str, size_t len) {
+    switch (self->type) {
+        case CSTRING_ARRAY_SEPARATOR_STRING:
+            if (self->num_bytes == 1) return memchr(str, self->bytes[0], len);
+            return cstring_array_find_separator(str, len, self->separator, self->match_len);
+        case CSTRING_ARRAY_SEPARATOR_SET:
+            return cstring_array_find_set(self, str, len);
+        default:
+            return NULL;
     }
-    return (int32_t)self->indices->a[i];
 }
 
-static inline char *CSTRING_ARRAY_FUNC(get_string)(CSTRING_ARRAY_NAME *self, uint32_t i) {
-    int32_t data_index = CSTRING_ARRAY_FUNC(get_offset)(self, i);
-    if (data_index < 0) return NULL;
-    return self->str->a + data_index;
+/*
+Walks the tokens split would produce from str[0..len] without copying anything: each
+token is returned as a pointer into str and a length, and isn't NUL-terminated.
+Stopping early is free, e.g. to read just the first field of a line:
+
+cstring_array_split_iter iter;
+cstring_array_split_iter_init(&iter, line, len, "\t", 1, false);
+const char *field;
+size_t field_len;
+if (cstring_array_split_iter_next(&iter, &field, &field_len)) ...
+
+str, and the separator string for cstring_array_split_iter_init, must outlive the
+iterator. Single-byte separators are found from one 64-byte block scan at a time,
+as in split_no_copy, other separators with cstring_array_separator_find.
+*/
+typedef struct {
+    const char *str;
+    size_t len;
+    size_t pos;
+    cstring_array_separator separator;
+    bool ignore_consecutive;
+    bool started;
+    bool done;
+    // Single-byte separators: the start of the block last scanned, or SIZE_MAX, and its hits
+    bool single_byte;
+    char byte;
+    size_t block;
+    uint64_t mask;
+} cstring_array_split_iter;
+
+static inline void cstring_array_split_iter_reset(cstring_array_split_iter *self, const char *str, size_t len, bool ignore_consecutive) {
+    self->str = str;
+    self->len = len;
+    self->pos = 0;
+    self->ignore_consecutive = ignore_consecutive;
+    self->started = false;
+    self->done = false;
+    self->single_byte = self->separator.type == CSTRING_ARRAY_SEPARATOR_STRING && self->separator.match_len == 1;
+    self->byte = self->separator.num_bytes == 1 ? self->separator.bytes[0] : (self->single_byte ? self->separator.separator[0] : '\0');
+    self->block = SIZE_MAX;
+    self->mask = 0;
 }
 
-static bool CSTRING_ARRAY_FUNC(extend)(CSTRING_ARRAY_NAME *array, CSTRING_ARRAY_NAME *other) {
-    if (array == NULL || other == NULL) return false;
-    size_t n = CSTRING_ARRAY_FUNC(num_strings)(other);
+static inline void cstring_array_split_iter_init(cstring_array_split_iter *self, const char *str, size_t len, const char *separator, size_t separator_len, bool ignore_consecutive) {
+    cstring_array_separator_init(&self->separator, separator, separator_len);
+    cstring_array_split_iter_reset(self, str, len, ignore_consecutive);
+}
 
-    for (size_t i = 0; i < n; i++) {
-        char *s_i = CSTRING_ARRAY_FUNC(get_string)(other, i);
-        CSTRING_ARRAY_FUNC(add_string)(array, s_i);
+// Splits at any byte of set, as split_set_options does
+static inline void cstring_array_split_iter_init_set(cstring_array_split_iter *self, const char *str, size_t len, const char *set, size_t set_len, bool ignore_consecutive) {
+    cstring_array_separator_init_set(&self->separator, set, set_len);
+    cstring_array_split_iter_reset(self, str, len, ignore_consecutive);
+}
+
+// Whether a separator match starts at pos
+static inline bool cstring_array_split_iter_at_separator(cstring_array_split_iter *self) {
+    const cstring_array_separator *separator = &self->separator;
+    if (self->pos >= self->len) return false;
+    switch (separator->type) {
+        case CSTRING_ARRAY_SEPARATOR_STRING:
+            if (self->single_byte) return self->str[self->pos] == self->byte;
+            return self->len - self->pos >= separator->match_len && memcmp(self->str + self->pos, separator->separator, separator->match_len) == 0;
+        case CSTRING_ARRAY_SEPARATOR_SET:
+            return separator->table[(uint8_t)self->str[self->pos]];
+        default:
+            return false;
     }
-    return true;
 }
 
+// Position of the next separator match at or after pos, or len
+static inline size_t cstring_array_split_iter_find(cstring_array_split_iter *self) {
+    if (!self->single_byte) {
+        const char *match = cstring_array_separator_find(&self->separator, self->str + self->pos, self->len - self->pos);
+        return match != NULL ? (size_t)(match - self->str) : self->len;
+    }
 
-static inline void CSTRING_ARRAY_FUNC(resize)(CSTRING_ARRAY_NAME *self, size_t size) {
-    if (size < CSTRING_ARRAY_FUNC(capacity)(self)) return;
-    CHAR_ARRAY_FUNC(resize)(self->str, size);
+    // Blocks start wherever the search does and stop at len, see cstring_array_scan_mask_tail
+    size_t pos = self->pos;
+    while (pos < self->len) {
+        if (self->block == SIZE_MAX || pos >= self->block + CSTRING_ARRAY_SCAN_BLOCK) {
+            self->block = pos;
+            self->mask = self->len - pos >= CSTRING_ARRAY_SCAN_BLOCK
+                ? cstring_array_scan_mask64(self->str + pos, self->byte, self->byte)
+                : cstring_array_scan_mask_tail(self->str + pos, self->len - pos, self->byte, self->byte);
+        }
+        uint64_t bits = self->mask & (~0ULL << (pos - self->block));
+        if (bits != 0) return self->block + cstring_array_ctz64(bits);
+        pos = self->block + CSTRING_ARRAY_SCAN_BLOCK;
+    }
+    return self->len;
 }
 
-static inline void CSTRING_ARRAY_FUNC(clear)(CSTRING_ARRAY_NAME *self) {
-    if (self == NULL) return;
+/*
+Sets *token and *token_len to the next token and returns true, or returns false once
+the tokens run out. The tokens match split_separator's: leading separators are
+skipped, every later separator ends a token (the first of each run with
+ignore_consecutive), and the text after the last separator is always a token, if
+possibly an empty one.
+*/
+static bool cstring_array_split_iter_next(cstring_array_split_iter *self, const char **token, size_t *token_len) {
+    if (self->done) return false;
+    size_t match_len = self->separator.match_len;
+    if (!self->started) {
+        while (cstring_array_split_iter_at_separator(self)) {
+            self->pos += match_len;
+        }
+        self->started = true;
+    }
 
-    if (self->indices != NULL) {
-        INDEX_ARRAY_FUNC(clear)(self->indices);
+    size_t start = self->pos;
+    size_t end = cstring_array_split_iter_find(self);
+    *token = self->str + start;
+    *token_len = end - start;
+    if (end == self->len) {
+        self->done = true;
+        return true;
     }
 
-    if (self->str != NULL) {
-        CHAR_ARRAY_FUNC(clear)(self->str);
+    self->pos = end + match_len;
+    if (self->ignore_consecutive) {
+        while (cstring_array_split_iter_at_separator(self)) {
+            self->pos += match_len;
+        }
     }
+    return true;
 }
 
-static inline uint32_t CSTRING_ARRAY_FUNC(add_string_len)(CSTRING_ARRAY_NAME *self, char *str, size_t len) {
-    uint32_t index = CSTRING_ARRAY_FUNC(start_token)(self);
-    CHAR_ARRAY_FUNC(append_len)(self->str, str, len);
-    CHAR_ARRAY_FUNC(terminate)(self->str);
-    return index;
-}
+#ifndef CSTRING_ARRAY_PARALLEL_MIN_CHUNK
+#define CSTRING_ARRAY_PARALLEL_MIN_CHUNK (1 << 16)
+#endif
 
-static inline void CSTRING_ARRAY_FUNC(append_string)(CSTRING_ARRAY_NAME *self, char *str) {
-    CHAR_ARRAY_FUNC(append)(self->str, str);
-}
+/*
+Defining CSTRING_ARRAY_STATS before the first include counts buffer growth, adds and
+splits across every array. The counters are updated with relaxed atomics, so arrays
+on different threads can share them, and like the rest of this header-only library
+they're per translation unit. Without the flag the hooks expand to nothing.
+*/
+#ifdef CSTRING_ARRAY_STATS
+#include <time.h>
 
-static inline void CSTRING_ARRAY_FUNC(append_string_len)(CSTRING_ARRAY_NAME *self, char *str, size_t len) {
-    CHAR_ARRAY_FUNC(append_len)(self->str, str, len);
+typedef struct {
+    uint64_t str_reallocs;
+    uint64_t indices_reallocs;
+    // Old capacity of every buffer that moved when it grew, i.e. what realloc copied
+    uint64_t bytes_copied;
+    // Strings and bytes added through add_string(s), append/cat_string, terminate and extend
+    uint64_t strings_added;
+    uint64_t bytes_added;
+    // Successful split calls, the strings they produced and the time they took
+    uint64_t split_calls;
+    uint64_t split_strings;
+    uint64_t split_ns;
+    // Capacity released by shrink_to_fit
+    uint64_t bytes_reclaimed;
+} cstring_array_statistics;
+
+static cstring_array_statistics cstring_array_global_stats;
+
+static inline void cstring_array_stats_add(uint64_t *counter, uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+#else
+    *counter += value;
+#endif
 }
 
-static inline void CSTRING_ARRAY_FUNC(cat_string)(CSTRING_ARRAY_NAME *self, char *str) {
-    CHAR_ARRAY_FUNC(cat)(self->str, str);
+static inline uint64_t cstring_array_stats_now_ns(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+    // Processor time, the best strict C99 offers
+    return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+#endif
 }
 
-static inline void CSTRING_ARRAY_FUNC(cat_string_len)(CSTRING_ARRAY_NAME *self, char *str, size_t len) {
-    CHAR_ARRAY_FUNC(cat_len)(self->str, str, len);
+static inline void cstring_array_stats_split(uint64_t start_ns, size_t num_strings) {
+    cstring_array_stats_add(&cstring_array_global_stats.split_calls, 1);
+    cstring_array_stats_add(&cstring_array_global_stats.split_strings, num_strings);
+    cstring_array_stats_add(&cstring_array_global_stats.split_ns, cstring_array_stats_now_ns() - start_ns);
 }
 
-static inline int64_t CSTRING_ARRAY_FUNC(token_length)(CSTRING_ARRAY_NAME *self, uint32_t i) {
-    if (INVALID_INDEX(i, self->indices->n)) {
-        return -1;
-    }
-    if (i < self->indices->n - 1) {
-        return self->indices->a[i+1] - self->indices->a[i] - 1;
-    } else {        
-        return self->str->n - self->indices->a[i] - 1;
+// A snapshot of the counters
+static cstring_array_statistics cstring_array_stats(void) {
+    cstring_array_statistics stats;
+    uint64_t *src = (uint64_t *)&cstring_array_global_stats;
+    uint64_t *dst = (uint64_t *)&stats;
+    for (size_t i = 0; i < sizeof(stats) / sizeof(uint64_t); i++) {
+#if defined(__GNUC__) || defined(__clang__)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+#else
+        dst[i] = src[i];
+#endif
     }
+    return stats;
 }
 
-static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_options)(char *str, const char *separator, size_t separator_len, bool ignore_consecutive, size_t *count) {
-    *count = 0;
-    CHAR_ARRAY_NAME *array = CHAR_ARRAY_FUNC(new_size)(strlen(str));
+static inline void cstring_array_stats_reset(void) {
+    memset(&cstring_array_global_stats, 0, sizeof(cstring_array_global_stats));
+}
 
-    bool last_was_separator = false;
-    bool first_char = false;
+static void cstring_array_stats_dump(FILE *file) {
+    cstring_array_statistics stats = cstring_array_stats();
+    fprintf(file, "str_reallocs: %llu\n", (unsigned long long)stats.str_reallocs);
+    fprintf(file, "indices_reallocs: %llu\n", (unsigned long long)stats.indices_reallocs);
+    fprintf(file, "bytes_copied: %llu\n", (unsigned long long)stats.bytes_copied);
+    fprintf(file, "strings_added: %llu\n", (unsigned long long)stats.strings_added);
+    fprintf(file, "bytes_added: %llu\n", (unsigned long long)stats.bytes_added);
+    fprintf(file, "split_calls: %llu\n", (unsigned long long)stats.split_calls);
+    fprintf(file, "split_strings: %llu\n", (unsigned long long)stats.split_strings);
+    fprintf(file, "split_ms: %.3f\n", (double)stats.split_ns / 1e6);
+    fprintf(file, "bytes_reclaimed: %llu\n", (unsigned long long)stats.bytes_reclaimed);
+}
 
-    while (*str) {
-        if ((separator_len == 1 && *str == separator[0]) || (memcmp(str, separator, separator_len) == 0)) {
-            if (first_char && (!ignore_consecutive || !last_was_separator)) {
-                CHAR_ARRAY_FUNC(push)(array, '\0');
-            }
-            str += separator_len;
-            last_was_separator = true;
-        } else {
-            CHAR_ARRAY_FUNC(push)(array, *str);
-            str++;
-            last_was_separator = false;
-            first_char = true;
-        }
-    }
-    CHAR_ARRAY_FUNC(push)(array, '\0');
+#define CSTRING_ARRAY_STATS_ADD(field, value) cstring_array_stats_add(&cstring_array_global_stats.field, (uint64_t)(value))
+#define CSTRING_ARRAY_STATS_TIMER(name) uint64_t name = cstring_array_stats_now_ns()
+#define CSTRING_ARRAY_STATS_SPLIT(start_ns, num_strings) cstring_array_stats_split(start_ns, num_strings)
+#else
+#define CSTRING_ARRAY_STATS_ADD(field, value) ((void)0)
+#define CSTRING_ARRAY_STATS_TIMER(name) ((void)0)
+#define CSTRING_ARRAY_STATS_SPLIT(start_ns, num_strings) ((void)0)
+#endif
 
-    CSTRING_ARRAY_NAME *string_array = CSTRING_ARRAY_FUNC(from_char_array)(array);
-    *count = CSTRING_ARRAY_FUNC(num_strings)(string_array);
+/*
+map callbacks write the transformed string into out, truncated to size bytes, and
+return its full length like snprintf. When that's more than size, map grows its
+output and calls again. A negative return stops the map.
+*/
+typedef int64_t (*cstring_array_map_func)(const char *str, size_t len, char *out, size_t size, void *data);
+typedef bool (*cstring_array_filter_func)(const char *str, size_t len, void *data);
 
-    return string_array;
-}
+// String a of the first array equals string b of the second, as returned by intersect
+typedef struct {
+    size_t a;
+    size_t b;
+} cstring_array_index_pair;
+
+// Open-addressing table over the second array of intersect and diff
+typedef struct {
+    uint64_t hash;
+    // id + 1, 0 if the slot is empty
+    size_t id;
+} cstring_array_join_slot;
 
+#ifndef CSTRING_ARRAY_DEFAULT_GARBAGE_RATIO
+#define CSTRING_ARRAY_DEFAULT_GARBAGE_RATIO 0.5
+#endif
 
-static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split)(char *str, const char *separator, size_t separator_len, size_t *count) {
-    return CSTRING_ARRAY_FUNC(split_options)(str, separator, separator_len, false, count);
+/*
+Removed strings are marked in a bitmap and their bytes counted as garbage, leaving str
+untouched until the array is compacted. The bitmap only grows as far as the highest
+removed index; bits past its end read as live.
+*/
+typedef struct {
+    uint64_t *bits;
+    size_t num_words;
+    size_t num_removed;
+    // Bytes held by removed strings, terminators included
+    size_t garbage_bytes;
+    // Compact automatically once garbage_bytes exceeds this fraction of str
+    double max_garbage_ratio;
+} cstring_array_tombstones;
+
+static cstring_array_tombstones *cstring_array_tombstones_new(void) {
+    cstring_array_tombstones *self = calloc(1, sizeof(cstring_array_tombstones));
+    if (self == NULL) return NULL;
+    self->max_garbage_ratio = CSTRING_ARRAY_DEFAULT_GARBAGE_RATIO;
+    return self;
 }
 
+static void cstring_array_tombstones_destroy(cstring_array_tombstones *self) {
+    if (self == NULL) return;
+    free(self->bits);
+    free(self);
+}
 
-static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_ignore_consecutive)(char *str, const char *separator, size_t separator_len, size_t *count) {
-    return CSTRING_ARRAY_FUNC(split_options)(str, separator, separator_len, true, count);
+static inline bool cstring_array_tombstones_test(const cstring_array_tombstones *self, size_t i) {
+    size_t word = i / 64;
+    return word < self->num_words && ((self->bits[word] >> (i % 64)) & 1);
 }
 
+static bool cstring_array_tombstones_set(cstring_array_tombstones *self, size_t i) {
+    size_t word = i / 64;
+    if (word >= self->num_words) {
+        size_t num_words = self->num_words * 2 > word + 1 ? self->num_words * 2 : word + 1;
+        uint64_t *bits = realloc(self->bits, num_words * sizeof(uint64_t));
+        if (bits == NULL) return false;
+        memset(bits + self->num_words, 0, (num_words - self->num_words) * sizeof(uint64_t));
+        self->bits = bits;
+        self->num_words = num_words;
+    }
+    self->bits[word] |= 1ULL << (i % 64);
+    return true;
+}
 
-static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_no_copy)(char *str, char separator, size_t *count) {
-    *count = 0;
-    char *ptr = str;
-    size_t len = strlen(str);
+// Resets to nothing removed, keeping the bitmap's memory and the ratio
+static inline void cstring_array_tombstones_clear(cstring_array_tombstones *self) {
+    if (self->bits != NULL) memset(self->bits, 0, self->num_words * sizeof(uint64_t));
+    self->num_removed = 0;
+    self->garbage_bytes = 0;
+}
 
-    for (int i = 0; i < len; i++, ptr++) {
-        if (*ptr == separator) {
-            *ptr = '\0';
+// First index in [i, n) that is removed (or live, when removed is false), n if none
+static inline size_t cstring_array_tombstones_find(const cstring_array_tombstones *self, size_t i, size_t n, bool removed) {
+    while (i < n) {
+        size_t word = i / 64;
+        uint64_t bits = word < self->num_words ? self->bits[word] : 0;
+        if (!removed) bits = ~bits;
+        bits &= ~0ULL << (i % 64);
+        if (bits != 0) {
+            size_t j = word * 64 + cstring_array_ctz64(bits);
+            return j < n ? j : n;
         }
+        // Past the bitmap everything is live
+        if (removed && word >= self->num_words) return n;
+        i = (word + 1) * 64;
+    }
+    return n;
+}
+
+/*
+Flips the 0x20 bit of every byte in [first, last]. The vector paths use the usual
+signed-compare range check: adding 0x80 - first maps the range onto the bottom of
+the signed byte range, so one compare against a constant finds it.
+*/
+static inline void cstring_array_ascii_flip_case(char *str, size_t len, char first, char last) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i shift = _mm256_set1_epi8((char)(0x80 - first));
+    __m256i limit = _mm256_set1_epi8((char)(-0x80 + (last - first) + 1));
+    __m256i bit = _mm256_set1_epi8(0x20);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i in_range = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+        _mm256_storeu_si256((__m256i *)(str + i), _mm256_xor_si256(v, _mm256_and_si256(in_range, bit)));
     }
+#elif defined(CSTRING_ARRAY_SSE2)
+    __m128i shift = _mm_set1_epi8((char)(0x80 - first));
+    __m128i limit = _mm_set1_epi8((char)(-0x80 + (last - first) + 1));
+    __m128i bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i in_range = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+        _mm_storeu_si128((__m128i *)(str + i), _mm_xor_si128(v, _mm_and_si128(in_range, bit)));
+    }
+#endif
+    for (; i < len; i++) {
+        if (str[i] >= first && str[i] <= last) str[i] ^= 0x20;
+    }
+}
 
-    CHAR_ARRAY_NAME *array = CHAR_ARRAY_FUNC(from_string_no_copy)(str, len);
-    CSTRING_ARRAY_NAME *string_array = CSTRING_ARRAY_FUNC(from_char_array)(array);
-    *count = CSTRING_ARRAY_FUNC(num_strings)(string_array);
+static inline void cstring_array_ascii_lower(char *str, size_t len) {
+    cstring_array_ascii_flip_case(str, len, 'A', 'Z');
+}
 
-    return string_array;
+static inline void cstring_array_ascii_upper(char *str, size_t len) {
+    cstring_array_ascii_flip_case(str, len, 'a', 'z');
 }
 
-static char **CSTRING_ARRAY_FUNC(to_strings)(CSTRING_ARRAY_NAME *self) {
-    char **strings = malloc(self->indices->n * sizeof(char *));
+// isspace in the C locale, without the locale lookup
+static inline bool cstring_array_is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#ifndef CSTRING_ARRAY_STREAM_CHUNK_SIZE
+#define CSTRING_ARRAY_STREAM_CHUNK_SIZE (1 << 16)
+#endif
 
-    for (int i = 0; i < CSTRING_ARRAY_FUNC(num_strings)(self); i++) {
-        char *str = CSTRING_ARRAY_FUNC(get_string)(self, i);
-        strings[i] = strdup(str);
+typedef struct {
+    // Bytes requested per read, CSTRING_ARRAY_STREAM_CHUNK_SIZE if 0
+    size_t chunk_size;
+    bool ignore_consecutive;
+} cstring_array_stream_options;
+
+// Reads up to size bytes into buf, returning 0 at end of input and -1 on error
+typedef int64_t (*cstring_array_read_func)(void *source, char *buf, size_t size);
+
+static int64_t cstring_array_read_file(void *source, char *buf, size_t size) {
+    FILE *file = source;
+    size_t n = fread(buf, 1, size, file);
+    if (n == 0 && ferror(file)) return -1;
+    return (int64_t)n;
+}
+
+#ifdef CSTRING_ARRAY_HAVE_UNISTD
+static int64_t cstring_array_read_fd(void *source, char *buf, size_t size) {
+    int fd = *(int *)source;
+    for (;;) {
+        ssize_t n = read(fd, buf, size);
+        if (n >= 0) return (int64_t)n;
+        if (errno != EINTR) return -1;
+    }
+}
+#endif
+
+/*
+Sorting works on entries caching the next 8 bytes of each string as a big-endian key
+(zero-padded after the terminator), so comparing keys as integers orders strings like
+strcmp without touching the pool. The sort is a multikey quicksort: a 3-way partition
+on the key, and when a group of entries shares a key with no NUL in it, the group is
+re-keyed with the following 8 bytes and sorted again. Strings are only dereferenced to
+reload keys, and in the final insertion sort of small ranges.
+*/
+typedef struct {
+    uint64_t key;
+    size_t offset;
+    size_t id;
+} cstring_array_sort_entry;
+
+#define CSTRING_ARRAY_SORT_INSERTION_THRESHOLD 16
+
+static inline uint64_t cstring_array_sort_key(const char *str) {
+    uint64_t key = 0;
+    int i = 0;
+    for (; i < 8 && str[i] != '\0'; i++) {
+        key = (key << 8) | (uint8_t)str[i];
+    }
+    // Shifting a 64-bit key by 64 is undefined, and the empty string's key is 0 anyway
+    if (i == 0) return 0;
+    return i < 8 ? key << (8 * (8 - i)) : key;
+}
+
+static inline int cstring_array_sort_compare(const cstring_array_sort_entry *a, const cstring_array_sort_entry *b, const char *base, size_t depth) {
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    // A NUL in the key means both strings end here
+    if ((a->key & 0xFF) == 0) return 0;
+    return strcmp(base + a->offset + depth + 8, base + b->offset + depth + 8);
+}
+
+static inline void cstring_array_sort_swap(cstring_array_sort_entry *a, cstring_array_sort_entry *b) {
+    cstring_array_sort_entry tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static inline uint64_t cstring_array_sort_median(uint64_t a, uint64_t b, uint64_t c) {
+    if (a < b) {
+        return b < c ? b : (a < c ? c : a);
+    }
+    return a < c ? a : (b < c ? c : b);
+}
+
+static void cstring_array_sort_entries(cstring_array_sort_entry *entries, size_t n, const char *base, size_t depth) {
+    while (n > CSTRING_ARRAY_SORT_INSERTION_THRESHOLD) {
+        uint64_t pivot = cstring_array_sort_median(entries[0].key, entries[n / 2].key, entries[n - 1].key);
+        size_t lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            if (entries[i].key < pivot) {
+                cstring_array_sort_swap(&entries[lt++], &entries[i++]);
+            } else if (entries[i].key > pivot) {
+                cstring_array_sort_swap(&entries[i], &entries[--gt]);
+            } else {
+                i++;
+            }
+        }
+
+        if ((pivot & 0xFF) != 0 && gt - lt > 1) {
+            for (size_t j = lt; j < gt; j++) {
+                entries[j].key = cstring_array_sort_key(base + entries[j].offset + depth + 8);
+            }
+            cstring_array_sort_entries(entries + lt, gt - lt, base, depth + 8);
+        }
+
+        // Recurse into the smaller side and loop on the larger one to bound the stack
+        if (lt < n - gt) {
+            cstring_array_sort_entries(entries, lt, base, depth);
+            entries += gt;
+            n -= gt;
+        } else {
+            cstring_array_sort_entries(entries + gt, n - gt, base, depth);
+            n = lt;
+        }
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        cstring_array_sort_entry e = entries[i];
+        size_t j = i;
+        while (j > 0 && cstring_array_sort_compare(&e, &entries[j - 1], base, depth) < 0) {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = e;
+    }
+}
+
+/*
+Arrays normally own heap buffers managed by char_array/array. An array created with
+new_allocator instead gets its struct and both buffers from a cstring_array_allocator,
+and all of its growth goes through the allocator's realloc. realloc is called with
+ptr == NULL and old_size == 0 for fresh allocations and returns NULL on failure.
+*/
+typedef struct cstring_array_allocator {
+    void *(*realloc)(struct cstring_array_allocator *self, void *ptr, size_t old_size, size_t size, size_t alignment);
+    void (*free)(struct cstring_array_allocator *self, void *ptr, size_t size);
+} cstring_array_allocator;
+
+/*
+cstring_array_arena is a bump allocator over a caller-supplied buffer, for arrays that
+live as long as a request. Allocation is a pointer bump, the most recent allocation grows
+in place, free is a no-op, and cstring_array_arena_reset drops every array allocated
+from the arena at once in O(1) while keeping the buffer for reuse.
+*/
+typedef struct {
+    cstring_array_allocator allocator;
+    char *buffer;
+    size_t size;
+    size_t used;
+    // Start of the most recent allocation
+    size_t last;
+} cstring_array_arena;
+
+static inline size_t cstring_array_align_up(size_t pos, size_t alignment) {
+    return (pos + alignment - 1) & ~(alignment - 1);
+}
+
+static void *cstring_array_arena_alloc(cstring_array_arena *arena, size_t size, size_t alignment) {
+    uintptr_t base = (uintptr_t)arena->buffer;
+    size_t start = cstring_array_align_up(base + arena->used, alignment) - base;
+    if (start > arena->size || size > arena->size - start) return NULL;
+    arena->last = start;
+    arena->used = start + size;
+    return arena->buffer + start;
+}
+
+static void *cstring_array_arena_realloc(cstring_array_allocator *allocator, void *ptr, size_t old_size, size_t size, size_t alignment) {
+    cstring_array_arena *arena = (cstring_array_arena *)allocator;
+    if (ptr != NULL && (char *)ptr == arena->buffer + arena->last && size <= arena->size - arena->last) {
+        arena->used = arena->last + size;
+        return ptr;
+    }
+    void *new_ptr = cstring_array_arena_alloc(arena, size, alignment);
+    if (new_ptr != NULL && ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    }
+    return new_ptr;
+}
+
+static void cstring_array_arena_free(cstring_array_allocator *allocator, void *ptr, size_t size) {
+    (void)allocator;
+    (void)ptr;
+    (void)size;
+}
+
+static inline void cstring_array_arena_init(cstring_array_arena *arena, void *buffer, size_t size) {
+    arena->allocator.realloc = cstring_array_arena_realloc;
+    arena->allocator.free = cstring_array_arena_free;
+    arena->buffer = buffer;
+    arena->size = size;
+    arena->used = 0;
+    arena->last = 0;
+}
+
+static inline void cstring_array_arena_reset(cstring_array_arena *arena) {
+    arena->used = 0;
+    arena->last = 0;
+}
+
+// Orders a NUL-terminated str against the len bytes of key, which contains no NUL
+static inline int cstring_array_compare_key(const char *str, const char *key, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] != key[i]) return (int)(uint8_t)str[i] - (int)(uint8_t)key[i];
+    }
+    return str[len] == '\0' ? 0 : 1;
+}
+
+// Like cstring_array_compare_key, but only the first len bytes of str count
+static inline int cstring_array_compare_prefix(const char *str, const char *prefix, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] != prefix[i]) return (int)(uint8_t)str[i] - (int)(uint8_t)prefix[i];
+    }
+    return 0;
+}
+
+#endif
+
+#ifdef CSTRING_ARRAY_ALIGNED
+#define CSTRING_ARRAY_NAME cstring_array_aligned
+#include "char_array/char_array_aligned.h"
+
+#define CHAR_ARRAY_NAME char_array_aligned
+
+#define INDEX_ARRAY_NAME index_array_aligned
+#define ARRAY_NAME index_array_aligned
+#define ARRAY_TYPE uint32_t
+#include "aligned_array/aligned_array.h"
+#undef ARRAY_NAME
+#undef ARRAY_TYPE
+
+#define CSTRING_ARRAY_INDEX_TYPE uint32_t
+#define CSTRING_ARRAY_INDEX_MAX UINT32_MAX
+#define CSTRING_ARRAY_ALIGNMENT 64
+
+#elif defined(CSTRING_ARRAY_64)
+#define CSTRING_ARRAY_NAME cstring_array64
+#include "char_array/char_array.h"
+
+#define CHAR_ARRAY_NAME char_array
+#define INDEX_ARRAY_NAME index_array64
+#define ARRAY_NAME index_array64
+#define ARRAY_TYPE uint64_t
+#include "array/array.h"
+#undef ARRAY_NAME
+#undef ARRAY_TYPE
+
+#define CSTRING_ARRAY_INDEX_TYPE uint64_t
+#define CSTRING_ARRAY_INDEX_MAX UINT64_MAX
+#define CSTRING_ARRAY_ALIGNMENT 16
+
+#elif defined(CSTRING_ARRAY_SMALL)
+// 16-bit offsets for pools of at most 64 KiB, always checked on add, see can_add
+#define CSTRING_ARRAY_NAME cstring_array_small
+#include "char_array/char_array.h"
+
+#define CHAR_ARRAY_NAME char_array
+#define INDEX_ARRAY_NAME index_array16
+#define ARRAY_NAME index_array16
+#define ARRAY_TYPE uint16_t
+#include "array/array.h"
+#undef ARRAY_NAME
+#undef ARRAY_TYPE
+
+#define CSTRING_ARRAY_INDEX_TYPE uint16_t
+#define CSTRING_ARRAY_INDEX_MAX UINT16_MAX
+#define CSTRING_ARRAY_ALIGNMENT 16
+
+#else
+#define CSTRING_ARRAY_NAME cstring_array
+#include "char_array/char_array.h"
+
+#define CHAR_ARRAY_NAME char_array
+#define INDEX_ARRAY_NAME index_array
+#define ARRAY_NAME index_array
+#define ARRAY_TYPE uint32_t
+#include "array/array.h"
+#undef ARRAY_NAME
+#undef ARRAY_TYPE
+
+#define CSTRING_ARRAY_INDEX_TYPE uint32_t
+#define CSTRING_ARRAY_INDEX_MAX UINT32_MAX
+#define CSTRING_ARRAY_ALIGNMENT 16
+
+#endif
+
+typedef struct {
+    INDEX_ARRAY_NAME *indices;
+    CHAR_ARRAY_NAME *str;
+    // NULL when the buffers are owned by char_array/array
+    cstring_array_allocator *allocator;
+    // NULL until a string is removed, see remove
+    cstring_array_tombstones *removed;
+} CSTRING_ARRAY_NAME;
+
+#define CONCAT_(a, b) a ## b
+#define CONCAT(a, b) CONCAT_(a, b)
+#define CSTRING_ARRAY_FUNC(func) CONCAT(CSTRING_ARRAY_NAME, _##func)
+#define CSTRING_ARRAY_TYPE(name) CONCAT(CSTRING_ARRAY_NAME, _##name)
+#define CHAR_ARRAY_FUNC(func) CONCAT(CHAR_ARRAY_NAME, _##func)
+#define INDEX_ARRAY_FUNC(func) CONCAT(INDEX_ARRAY_NAME, _##func)
+
+
+static void CSTRING_ARRAY_FUNC(destroy)(CSTRING_ARRAY_NAME *self) {
+    if (self == NULL) return;
+    cstring_array_tombstones_destroy(self->removed);
+    cstring_array_allocator *allocator = self->allocator;
+    if (allocator != NULL) {
+        allocator->free(allocator, self->indices->a, self->indices->m * sizeof(CSTRING_ARRAY_INDEX_TYPE));
+        allocator->free(allocator, self->indices, sizeof(INDEX_ARRAY_NAME));
+        allocator->free(allocator, self->str->a, self->str->m);
+        allocator->free(allocator, self->str, sizeof(CHAR_ARRAY_NAME));
+        allocator->free(allocator, self, sizeof(CSTRING_ARRAY_NAME));
+        return;
+    }
+    if (self->indices) {
+        INDEX_ARRAY_FUNC(destroy)(self->indices);
+    }
+    if (self->str) {
+        CHAR_ARRAY_FUNC(destroy)(self->str);
+    }
+    free(self);
+}
+
+// Grows the offsets buffer to hold exactly size offsets, if it's smaller
+static bool CSTRING_ARRAY_FUNC(resize_indices)(CSTRING_ARRAY_NAME *self, size_t size) {
+    INDEX_ARRAY_NAME *indices = self->indices;
+    if (size <= indices->m) return true;
+    size_t width = sizeof(CSTRING_ARRAY_INDEX_TYPE);
+#ifdef CSTRING_ARRAY_STATS
+    const void *old_a = indices->a;
+    size_t old_m = indices->m;
+#endif
+    if (self->allocator != NULL) {
+        void *a = self->allocator->realloc(self->allocator, indices->a, indices->m * width, size * width, CSTRING_ARRAY_ALIGNMENT);
+        if (a == NULL) return false;
+        indices->a = a;
+        indices->m = size;
+    } else {
+        INDEX_ARRAY_FUNC(resize)(indices, size);
+        if (indices->m < size) return false;
+    }
+    CSTRING_ARRAY_STATS_ADD(indices_reallocs, 1);
+    CSTRING_ARRAY_STATS_ADD(bytes_copied, (const void *)indices->a != old_a ? old_m * width : 0);
+    return true;
+}
+
+static bool CSTRING_ARRAY_FUNC(resize_str)(CSTRING_ARRAY_NAME *self, size_t size) {
+    CHAR_ARRAY_NAME *str = self->str;
+    if (size <= str->m) return true;
+#ifdef CSTRING_ARRAY_STATS
+    const void *old_a = str->a;
+    size_t old_m = str->m;
+#endif
+    if (self->allocator != NULL) {
+        void *a = self->allocator->realloc(self->allocator, str->a, str->m, size, CSTRING_ARRAY_ALIGNMENT);
+        if (a == NULL) return false;
+        str->a = a;
+        str->m = size;
+    } else {
+        CHAR_ARRAY_FUNC(resize)(str, size);
+        if (str->m < size) return false;
+    }
+    CSTRING_ARRAY_STATS_ADD(str_reallocs, 1);
+    CSTRING_ARRAY_STATS_ADD(bytes_copied, (const void *)str->a != old_a ? old_m : 0);
+    return true;
+}
+
+/*
+Every write into indices or str reserves through these first, growing geometrically,
+so arrays with an allocator never reach char_array/array's own reallocation.
+*/
+static inline bool CSTRING_ARRAY_FUNC(reserve_indices)(CSTRING_ARRAY_NAME *self, size_t size) {
+    if (size <= self->indices->m) return true;
+    size_t new_size = self->indices->m * 2;
+    return CSTRING_ARRAY_FUNC(resize_indices)(self, new_size > size ? new_size : size);
+}
+
+static inline bool CSTRING_ARRAY_FUNC(reserve_str)(CSTRING_ARRAY_NAME *self, size_t size) {
+    if (size <= self->str->m) return true;
+    size_t new_size = self->str->m * 2;
+    return CSTRING_ARRAY_FUNC(resize_str)(self, new_size > size ? new_size : size);
+}
+
+/*
+indices->a[indices->n], the slot past the last offset, holds the end of the last
+string's terminator. That's str->n once the string is terminated. While it's still
+open, after start_token and append_string, a NUL is kept at str->a[str->n] without
+being counted, and the sentinel is str->n + 1. Either way the length of string i is
+a[i + 1] - a[i] - 1 for every i and every string is NUL-terminated, with no special
+case for the last one. Every function here that changes str->n or indices->n keeps it
+current; see the top of this file for writes through char_array.
+*/
+static inline bool CSTRING_ARRAY_FUNC(update_end)(CSTRING_ARRAY_NAME *self) {
+    INDEX_ARRAY_NAME *indices = self->indices;
+    CHAR_ARRAY_NAME *str = self->str;
+    if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, indices->n + 1)) return false;
+    size_t end = str->n;
+    // Open when it's empty or its last byte isn't a terminator
+    if (indices->n > 0 && (end == (size_t)indices->a[indices->n - 1] || str->a[end - 1] != '\0')) {
+        if (!CSTRING_ARRAY_FUNC(reserve_str)(self, end + 1)) return false;
+        str->a[end++] = '\0';
+    }
+    indices->a[indices->n] = (CSTRING_ARRAY_INDEX_TYPE)end;
+    return true;
+}
+
+// Counts the NUL kept after an open last string (see update_end), terminating it for good
+static inline void CSTRING_ARRAY_FUNC(close_token)(CSTRING_ARRAY_NAME *self) {
+    self->str->n = (size_t)self->indices->a[self->indices->n];
+}
+
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(new)(void) {
+    CSTRING_ARRAY_NAME *array = malloc(sizeof(CSTRING_ARRAY_NAME));
+    if (array == NULL) return NULL;
+
+    array->indices = INDEX_ARRAY_FUNC(new)();
+    if (array->indices == NULL) {
+        free(array);
+        return NULL;
+    }
+
+    array->str = CHAR_ARRAY_FUNC(new)();
+    if (array->str == NULL) {
+        INDEX_ARRAY_FUNC(destroy)(array->indices);
+        free(array);
+        return NULL;
+    }
+    array->allocator = NULL;
+    array->removed = NULL;
+
+    // The end sentinel, see update_end
+    if (!CSTRING_ARRAY_FUNC(reserve_indices)(array, 1) || !CSTRING_ARRAY_FUNC(update_end)(array)) {
+        CSTRING_ARRAY_FUNC(destroy)(array);
+        return NULL;
+    }
+
+    return array;
+}
+
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(new_size)(size_t size) {
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
+    CHAR_ARRAY_FUNC(resize)(array->str, size);
+    return array;
+}
+
+/*
+Whether offsets can address a pool of size bytes, terminators included, for the
+splitters that store offsets directly instead of going through can_add. Always true
+unless checked.
+*/
+static inline bool CSTRING_ARRAY_FUNC(can_address)(size_t size) {
+#if defined(CSTRING_ARRAY_CHECKED) || defined(CSTRING_ARRAY_SMALL)
+    return size <= CSTRING_ARRAY_INDEX_MAX;
+#else
+    (void)size;
+    return true;
+#endif
+}
+
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(new_allocator)(cstring_array_allocator *allocator, size_t num_strings, size_t num_bytes) {
+    size_t alignment = CSTRING_ARRAY_ALIGNMENT;
+    if (num_strings == 0) num_strings = 1;
+    if (num_bytes == 0) num_bytes = 1;
+
+    CSTRING_ARRAY_NAME *array = allocator->realloc(allocator, NULL, 0, sizeof(CSTRING_ARRAY_NAME), alignment);
+    INDEX_ARRAY_NAME *indices = allocator->realloc(allocator, NULL, 0, sizeof(INDEX_ARRAY_NAME), alignment);
+    CHAR_ARRAY_NAME *str = allocator->realloc(allocator, NULL, 0, sizeof(CHAR_ARRAY_NAME), alignment);
+    CSTRING_ARRAY_INDEX_TYPE *offsets = allocator->realloc(allocator, NULL, 0, num_strings * sizeof(CSTRING_ARRAY_INDEX_TYPE), alignment);
+    char *chars = allocator->realloc(allocator, NULL, 0, num_bytes, alignment);
+
+    if (array == NULL || indices == NULL || str == NULL || offsets == NULL || chars == NULL) {
+        if (chars != NULL) allocator->free(allocator, chars, num_bytes);
+        if (offsets != NULL) allocator->free(allocator, offsets, num_strings * sizeof(CSTRING_ARRAY_INDEX_TYPE));
+        if (str != NULL) allocator->free(allocator, str, sizeof(CHAR_ARRAY_NAME));
+        if (indices != NULL) allocator->free(allocator, indices, sizeof(INDEX_ARRAY_NAME));
+        if (array != NULL) allocator->free(allocator, array, sizeof(CSTRING_ARRAY_NAME));
+        return NULL;
+    }
+
+    memset(indices, 0, sizeof(INDEX_ARRAY_NAME));
+    indices->a = offsets;
+    indices->m = num_strings;
+    memset(str, 0, sizeof(CHAR_ARRAY_NAME));
+    str->a = chars;
+    str->m = num_bytes;
+
+    array->indices = indices;
+    array->str = str;
+    array->allocator = allocator;
+    array->removed = NULL;
+    CSTRING_ARRAY_FUNC(update_end)(array);
+    return array;
+}
+
+/*
+Creates an array whose struct and buffers all come from arena, sized for the given
+estimates and growing inside the arena past them. destroy is a no-op for these arrays;
+they go away with cstring_array_arena_reset.
+*/
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(new_arena)(cstring_array_arena *arena, size_t num_strings, size_t num_bytes) {
+    return CSTRING_ARRAY_FUNC(new_allocator)(&arena->allocator, num_strings, num_bytes);
+}
+
+/*
+Pushes the offset following every NUL byte in str[0..len - 1), i.e. the start of each
+string after the first. The trailing byte is the terminator of the last string and
+doesn't start a new one. Capacity is reserved a block at a time, so the inner loop
+writes offsets directly.
+*/
+static bool CSTRING_ARRAY_FUNC(scan_boundaries)(CSTRING_ARRAY_NAME *self, const char *str, size_t len) {
+    INDEX_ARRAY_NAME *indices = self->indices;
+    if (len == 0) return true;
+    size_t end = len - 1;
+    size_t i = 0;
+
+    for (; i + CSTRING_ARRAY_SCAN_BLOCK <= end; i += CSTRING_ARRAY_SCAN_BLOCK) {
+        uint64_t mask = cstring_array_scan_mask64(str + i, '\0', '\0');
+        if (mask == 0) continue;
+        if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, indices->n + CSTRING_ARRAY_SCAN_BLOCK)) return false;
+        CSTRING_ARRAY_INDEX_TYPE *a = indices->a;
+        size_t n = indices->n;
+        do {
+            a[n++] = (CSTRING_ARRAY_INDEX_TYPE)(i + cstring_array_ctz64(mask) + 1);
+            mask &= mask - 1;
+        } while (mask);
+        indices->n = n;
+    }
+
+    for (; i < end; i++) {
+        if (str[i] == '\0') {
+            if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, indices->n + 1)) return false;
+            indices->a[indices->n++] = (CSTRING_ARRAY_INDEX_TYPE)(i + 1);
+        }
+    }
+    return true;
+}
+
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(from_char_array)(CHAR_ARRAY_NAME *str) {
+    if (str == NULL) return NULL;
+    if (str->n == 0)
+        return CSTRING_ARRAY_FUNC(new)();
+    // An unterminated last string gets a NUL past str->n (see update_end)
+    if (!CSTRING_ARRAY_FUNC(can_address)(str->n + (str->a[str->n - 1] != '\0'))) return NULL;
+
+    CSTRING_ARRAY_NAME *array = malloc(sizeof(CSTRING_ARRAY_NAME));
+    if (array == NULL) return NULL;
+
+    array->str = str;
+    array->allocator = NULL;
+    array->removed = NULL;
+    array->indices = INDEX_ARRAY_FUNC(new_size)(1);
+    if (array->indices == NULL) {
+        free(array);
+        return NULL;
+    }
+
+    bool ok = CSTRING_ARRAY_FUNC(reserve_indices)(array, 1);
+    // The first string starts at 0
+    if (ok) array->indices->a[array->indices->n++] = 0;
+    if (!ok || !CSTRING_ARRAY_FUNC(scan_boundaries)(array, str->a, str->n) || !CSTRING_ARRAY_FUNC(update_end)(array)) {
+        INDEX_ARRAY_FUNC(destroy)(array->indices);
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+static inline size_t CSTRING_ARRAY_FUNC(num_strings)(CSTRING_ARRAY_NAME *self) {
+    if (self == NULL) return 0;
+    return self->indices->n;
+}
+
+/*
+With CSTRING_ARRAY_CHECKED defined, adding a string that would take the pool past what
+the offset type can address fails instead of silently wrapping: start_token, add_string
+and add_string_len leave the array untouched and return CSTRING_ARRAY_INDEX_MAX of the
+instantiation, i.e. UINT32_MAX for cstring_array/cstring_array_aligned and UINT64_MAX
+for cstring_array64. cstring_array_small, whose 64 KiB limit is easy to reach, always
+checks.
+*/
+static inline bool CSTRING_ARRAY_FUNC(can_add)(CSTRING_ARRAY_NAME *self, size_t len) {
+#if defined(CSTRING_ARRAY_CHECKED) || defined(CSTRING_ARRAY_SMALL)
+    // The sentinel, which counts the NUL of an open last string (see update_end)
+    size_t used = self->indices->a[self->indices->n];
+    return used < CSTRING_ARRAY_INDEX_MAX && len < CSTRING_ARRAY_INDEX_MAX - used;
+#else
+    (void)self;
+    (void)len;
+    return true;
+#endif
+}
+
+// Starts a new, open string, terminating the previous one if it's still open
+static inline CSTRING_ARRAY_INDEX_TYPE CSTRING_ARRAY_FUNC(start_token)(CSTRING_ARRAY_NAME *self) {
+    if (!CSTRING_ARRAY_FUNC(can_add)(self, 0)) return CSTRING_ARRAY_INDEX_MAX;
+    if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, self->indices->n + 2)) return CSTRING_ARRAY_INDEX_MAX;
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(self, self->indices->a[self->indices->n] + 1)) return CSTRING_ARRAY_INDEX_MAX;
+    CSTRING_ARRAY_FUNC(close_token)(self);
+    CSTRING_ARRAY_INDEX_TYPE index = (CSTRING_ARRAY_INDEX_TYPE)self->str->n;
+    self->indices->a[self->indices->n++] = index;
+    // Reserved above, so this can't fail
+    CSTRING_ARRAY_FUNC(update_end)(self);
+    CSTRING_ARRAY_STATS_ADD(strings_added, 1);
+    return index;
+}
+
+static inline size_t CSTRING_ARRAY_FUNC(capacity)(CSTRING_ARRAY_NAME *self) {
+    return self->str->m;
+}
+
+static inline size_t CSTRING_ARRAY_FUNC(used)(CSTRING_ARRAY_NAME *self) {
+    return self->str->n;
+}
+
+static inline void CSTRING_ARRAY_FUNC(terminate)(CSTRING_ARRAY_NAME *self) {
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(self, self->str->n + 1)) return;
+    self->str->a[self->str->n++] = '\0';
+    CSTRING_ARRAY_STATS_ADD(bytes_added, 1);
+    CSTRING_ARRAY_FUNC(update_end)(self);
+}
+
+static inline CSTRING_ARRAY_INDEX_TYPE CSTRING_ARRAY_FUNC(add_string_len)(CSTRING_ARRAY_NAME *self, char *str, size_t len) {
+    if (!CSTRING_ARRAY_FUNC(can_add)(self, len)) return CSTRING_ARRAY_INDEX_MAX;
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(self, (size_t)self->indices->a[self->indices->n] + len + 1)) return CSTRING_ARRAY_INDEX_MAX;
+    CSTRING_ARRAY_INDEX_TYPE index = CSTRING_ARRAY_FUNC(start_token)(self);
+    if (index == CSTRING_ARRAY_INDEX_MAX) return index;
+    CHAR_ARRAY_NAME *chars = self->str;
+    memcpy(chars->a + chars->n, str, len);
+    chars->n += len;
+    chars->a[chars->n++] = '\0';
+    // start_token reserved the end slot
+    self->indices->a[self->indices->n] = (CSTRING_ARRAY_INDEX_TYPE)chars->n;
+    CSTRING_ARRAY_STATS_ADD(bytes_added, len + 1);
+    return index;
+}
+
+static inline CSTRING_ARRAY_INDEX_TYPE CSTRING_ARRAY_FUNC(add_string)(CSTRING_ARRAY_NAME *self, char *str) {
+    return CSTRING_ARRAY_FUNC(add_string_len)(self, str, strlen(str));
+}
+
+/*
+Adds n strings with known lengths. The total size is computed first so indices and str
+are each reserved once, then filled by one memcpy per string. Returns false, leaving the
+array untouched, if the reservation fails (or would overflow the offsets when checked).
+*/
+static bool CSTRING_ARRAY_FUNC(add_strings_len)(CSTRING_ARRAY_NAME *self, char **strings, const size_t *lengths, size_t n) {
+    if (self == NULL) return false;
+    if (n == 0) return true;
+
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += lengths[i] + 1;
+    }
+    if (!CSTRING_ARRAY_FUNC(can_add)(self, total - 1)) return false;
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(self, (size_t)self->indices->a[self->indices->n] + total)) return false;
+    if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, self->indices->n + n + 1)) return false;
+
+    CSTRING_ARRAY_FUNC(close_token)(self);
+    char *out = self->str->a;
+    CSTRING_ARRAY_INDEX_TYPE *offsets = self->indices->a + self->indices->n;
+    size_t pos = self->str->n;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = lengths[i];
+        offsets[i] = (CSTRING_ARRAY_INDEX_TYPE)pos;
+        memcpy(out + pos, strings[i], len);
+        pos += len;
+        out[pos++] = '\0';
+    }
+    offsets[n] = (CSTRING_ARRAY_INDEX_TYPE)pos;
+    self->str->n = pos;
+    self->indices->n += n;
+    CSTRING_ARRAY_STATS_ADD(strings_added, n);
+    CSTRING_ARRAY_STATS_ADD(bytes_added, total);
+    return true;
+}
+
+// Like add_strings_len for NUL-terminated strings, which are measured once up front
+static bool CSTRING_ARRAY_FUNC(add_strings)(CSTRING_ARRAY_NAME *self, char **strings, size_t n) {
+    if (self == NULL) return false;
+    size_t *lengths = malloc((n > 0 ? n : 1) * sizeof(size_t));
+    if (lengths == NULL) return false;
+    for (size_t i = 0; i < n; i++) {
+        lengths[i] = strlen(strings[i]);
+    }
+    bool ok = CSTRING_ARRAY_FUNC(add_strings_len)(self, strings, lengths, n);
+    free(lengths);
+    return ok;
+}
+
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(from_strings)(char **strings, size_t n) {
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
+    if (array == NULL) return NULL;
+    if (!CSTRING_ARRAY_FUNC(add_strings)(array, strings, n)) {
+        CSTRING_ARRAY_FUNC(destroy)(array);
+        return NULL;
+    }
+    return array;
+}
+
+
+static inline int64_t CSTRING_ARRAY_FUNC(get_offset)(CSTRING_ARRAY_NAME *self, size_t i) {
+    if (INVALID_INDEX(i, self->indices->n)) {
+        return -1;
+    }
+    return (int64_t)self->indices->a[i];
+}
+
+static inline bool CSTRING_ARRAY_FUNC(is_removed)(CSTRING_ARRAY_NAME *self, size_t i) {
+    return self->removed != NULL && cstring_array_tombstones_test(self->removed, i);
+}
+
+static inline char *CSTRING_ARRAY_FUNC(get_string)(CSTRING_ARRAY_NAME *self, size_t i) {
+    int64_t data_index = CSTRING_ARRAY_FUNC(get_offset)(self, i);
+    if (data_index < 0 || CSTRING_ARRAY_FUNC(is_removed)(self, i)) return NULL;
+    return self->str->a + data_index;
+}
+
+// String i and its length, read off the offsets (see update_end), or NULL if i is out of range or removed
+static inline char *CSTRING_ARRAY_FUNC(get_string_len)(CSTRING_ARRAY_NAME *self, size_t i, size_t *len) {
+    if (i >= self->indices->n || CSTRING_ARRAY_FUNC(is_removed)(self, i)) {
+        *len = 0;
+        return NULL;
+    }
+    const CSTRING_ARRAY_INDEX_TYPE *a = self->indices->a;
+    *len = (size_t)(a[i + 1] - a[i]) - 1;
+    return self->str->a + a[i];
+}
+
+// dst[i] = src[i] + delta, wrapping, so a negative delta can be passed as its two's complement
+static inline void CSTRING_ARRAY_FUNC(rebase_offsets)(CSTRING_ARRAY_INDEX_TYPE *dst, const CSTRING_ARRAY_INDEX_TYPE *src, size_t n, CSTRING_ARRAY_INDEX_TYPE delta) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(CSTRING_ARRAY_SSE2)
+    const size_t per_vector = sizeof(__m128i) / sizeof(CSTRING_ARRAY_INDEX_TYPE);
+    if (sizeof(CSTRING_ARRAY_INDEX_TYPE) == 2) {
+        __m128i d = _mm_set1_epi16((short)(uint16_t)delta);
+        for (; i + per_vector <= n; i += per_vector) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi16(v, d));
+        }
+    } else if (sizeof(CSTRING_ARRAY_INDEX_TYPE) == 4) {
+        __m128i d = _mm_set1_epi32((int)(uint32_t)delta);
+        for (; i + per_vector <= n; i += per_vector) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi32(v, d));
+        }
+    } else if (sizeof(CSTRING_ARRAY_INDEX_TYPE) == 8) {
+        __m128i d = _mm_set1_epi64x((long long)(uint64_t)delta);
+        for (; i + per_vector <= n; i += per_vector) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi64(v, d));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (CSTRING_ARRAY_INDEX_TYPE)(src[i] + delta);
+    }
+}
+
+/*
+Appends strings [start, end) of other. Since other->str already holds them as one
+NUL-delimited block, this is a single reserve, one memcpy of the byte span and one
+pass adding the new base to other's offsets. array and other may be the same array.
+*/
+static bool CSTRING_ARRAY_FUNC(extend_span)(CSTRING_ARRAY_NAME *array, CSTRING_ARRAY_NAME *other, size_t start, size_t end) {
+
+    // Every string is terminated up to the sentinel, an open last one included (see update_end)
+    size_t byte_start = other->indices->a[start];
+    size_t span = other->indices->a[end] - byte_start;
+
+    size_t base = array->indices->a[array->indices->n];
+    size_t num_new = end - start;
+    if (!CSTRING_ARRAY_FUNC(can_add)(array, span)) return false;
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(array, base + span)) return false;
+    if (!CSTRING_ARRAY_FUNC(reserve_indices)(array, array->indices->n + num_new + 1)) return false;
+
+    memcpy(array->str->a + base, other->str->a + byte_start, span);
+    array->str->n = base + span;
+
+    CSTRING_ARRAY_FUNC(rebase_offsets)(array->indices->a + array->indices->n, other->indices->a + start, num_new, (CSTRING_ARRAY_INDEX_TYPE)(base - byte_start));
+    array->indices->n += num_new;
+    array->indices->a[array->indices->n] = (CSTRING_ARRAY_INDEX_TYPE)array->str->n;
+    CSTRING_ARRAY_STATS_ADD(strings_added, num_new);
+    CSTRING_ARRAY_STATS_ADD(bytes_added, span);
+    return true;
+}
+
+static bool CSTRING_ARRAY_FUNC(extend_range)(CSTRING_ARRAY_NAME *array, CSTRING_ARRAY_NAME *other, size_t start, size_t end) {
+    if (array == NULL || other == NULL) return false;
+    size_t n = CSTRING_ARRAY_FUNC(num_strings)(other);
+    if (end > n) end = n;
+    if (start >= end) return true;
+    if (other->removed == NULL || other->removed->num_removed == 0) {
+        return CSTRING_ARRAY_FUNC(extend_span)(array, other, start, end);
+    }
+
+    // One span per run of strings that haven't been removed
+    size_t i = cstring_array_tombstones_find(other->removed, start, end, false);
+    while (i < end) {
+        size_t run_end = cstring_array_tombstones_find(other->removed, i, end, true);
+        if (!CSTRING_ARRAY_FUNC(extend_span)(array, other, i, run_end)) return false;
+        i = cstring_array_tombstones_find(other->removed, run_end, end, false);
+    }
+    return true;
+}
+
+static inline bool CSTRING_ARRAY_FUNC(extend)(CSTRING_ARRAY_NAME *array, CSTRING_ARRAY_NAME *other) {
+    if (array == NULL || other == NULL) return false;
+    return CSTRING_ARRAY_FUNC(extend_range)(array, other, 0, CSTRING_ARRAY_FUNC(num_strings)(other));
+}
+
+
+static inline void CSTRING_ARRAY_FUNC(resize)(CSTRING_ARRAY_NAME *self, size_t size) {
+    if (size < CSTRING_ARRAY_FUNC(capacity)(self)) return;
+    CSTRING_ARRAY_FUNC(resize_str)(self, size);
+}
+
+static inline void CSTRING_ARRAY_FUNC(clear)(CSTRING_ARRAY_NAME *self) {
+    if (self == NULL) return;
+
+    if (self->indices != NULL) {
+        INDEX_ARRAY_FUNC(clear)(self->indices);
+    }
+
+    if (self->str != NULL) {
+        CHAR_ARRAY_FUNC(clear)(self->str);
+    }
+
+    if (self->indices != NULL && self->str != NULL) {
+        CSTRING_ARRAY_FUNC(update_end)(self);
+    }
+
+    if (self->removed != NULL) {
+        cstring_array_tombstones_clear(self->removed);
+    }
+}
+
+/*
+Releases the spare capacity of str and indices, e.g. once a long-lived array is done
+growing, and returns the bytes reclaimed. Heap buffers are replaced by exactly sized
+copies, since char_array/array only ever grow.
+*/
+static size_t CSTRING_ARRAY_FUNC(shrink_to_fit)(CSTRING_ARRAY_NAME *self) {
+    size_t reclaimed = 0;
+    size_t width = sizeof(CSTRING_ARRAY_INDEX_TYPE);
+    // Arrays always keep room for the end sentinel and at least one byte, and an open
+    // last string keeps its uncounted NUL (see update_end)
+    size_t end = self->indices->a[self->indices->n];
+    size_t str_size = end > 0 ? end : 1;
+    size_t indices_size = self->indices->n + 1;
+
+    if (self->str->m > str_size) {
+        size_t old_m = self->str->m;
+        if (self->allocator != NULL) {
+            void *a = self->allocator->realloc(self->allocator, self->str->a, self->str->m, str_size, CSTRING_ARRAY_ALIGNMENT);
+            if (a != NULL) {
+                self->str->a = a;
+                self->str->m = str_size;
+            }
+        } else {
+            CHAR_ARRAY_NAME *str = CHAR_ARRAY_FUNC(new_size)(str_size);
+            if (str != NULL) {
+                memcpy(str->a, self->str->a, end);
+                str->n = self->str->n;
+                CHAR_ARRAY_FUNC(destroy)(self->str);
+                self->str = str;
+            }
+        }
+        if (self->str->m < old_m) reclaimed += old_m - self->str->m;
+    }
+
+    if (self->indices->m > indices_size) {
+        size_t old_m = self->indices->m;
+        if (self->allocator != NULL) {
+            void *a = self->allocator->realloc(self->allocator, self->indices->a, self->indices->m * width, indices_size * width, CSTRING_ARRAY_ALIGNMENT);
+            if (a != NULL) {
+                self->indices->a = a;
+                self->indices->m = indices_size;
+            }
+        } else {
+            INDEX_ARRAY_NAME *indices = INDEX_ARRAY_FUNC(new_size)(indices_size);
+            if (indices != NULL) {
+                memcpy(indices->a, self->indices->a, indices_size * width);
+                indices->n = self->indices->n;
+                INDEX_ARRAY_FUNC(destroy)(self->indices);
+                self->indices = indices;
+            }
+        }
+        if (self->indices->m < old_m) reclaimed += (old_m - self->indices->m) * width;
+    }
+
+    CSTRING_ARRAY_STATS_ADD(bytes_reclaimed, reclaimed);
+    return reclaimed;
+}
+
+static inline size_t CSTRING_ARRAY_FUNC(num_removed)(CSTRING_ARRAY_NAME *self) {
+    return self->removed != NULL ? self->removed->num_removed : 0;
+}
+
+/*
+Drops removed strings for good: each run of surviving strings is slid down with one
+memmove, and its offsets rewritten with rebase_offsets in the same pass. Strings after
+a removed one get new, lower indices.
+*/
+static void CSTRING_ARRAY_FUNC(compact)(CSTRING_ARRAY_NAME *self) {
+    cstring_array_tombstones *removed = self->removed;
+    if (removed == NULL || removed->num_removed == 0) return;
+
+    size_t n = CSTRING_ARRAY_FUNC(num_strings)(self);
+    CSTRING_ARRAY_INDEX_TYPE *offsets = self->indices->a;
+    char *chars = self->str->a;
+    size_t num_out = 0;
+    size_t bytes_out = 0;
+    size_t i = cstring_array_tombstones_find(removed, 0, n, false);
+    while (i < n) {
+        size_t run_end = cstring_array_tombstones_find(removed, i, n, true);
+        size_t byte_start = offsets[i];
+        size_t span = offsets[run_end] - byte_start;
+        memmove(chars + bytes_out, chars + byte_start, span);
+        // Offsets only move down, so rewriting them in place never clobbers one not yet read
+        CSTRING_ARRAY_FUNC(rebase_offsets)(offsets + num_out, offsets + i, run_end - i, (CSTRING_ARRAY_INDEX_TYPE)(bytes_out - byte_start));
+        num_out += run_end - i;
+        bytes_out += span;
+        i = cstring_array_tombstones_find(removed, run_end, n, false);
+    }
+    self->indices->n = num_out;
+    self->str->n = bytes_out;
+    CSTRING_ARRAY_FUNC(update_end)(self);
+    cstring_array_tombstones_clear(removed);
+}
+
+static inline void CSTRING_ARRAY_FUNC(maybe_compact)(CSTRING_ARRAY_NAME *self) {
+    cstring_array_tombstones *removed = self->removed;
+    if ((double)removed->garbage_bytes > removed->max_garbage_ratio * (double)self->str->n) {
+        CSTRING_ARRAY_FUNC(compact)(self);
+    }
+}
+
+/*
+Sets the fraction of str that removed strings may take up before remove and remove_if
+compact the array. Ratios of 1 or more turn automatic compaction off.
+*/
+static bool CSTRING_ARRAY_FUNC(set_max_garbage_ratio)(CSTRING_ARRAY_NAME *self, double ratio) {
+    if (self->removed == NULL) {
+        self->removed = cstring_array_tombstones_new();
+        if (self->removed == NULL) return false;
+    }
+    self->removed->max_garbage_ratio = ratio;
+    return true;
+}
+
+static bool CSTRING_ARRAY_FUNC(mark_removed)(CSTRING_ARRAY_NAME *self, size_t i) {
+    if (self->removed == NULL) {
+        self->removed = cstring_array_tombstones_new();
+        if (self->removed == NULL) return false;
+    }
+    if (!cstring_array_tombstones_set(self->removed, i)) return false;
+    self->removed->num_removed++;
+    self->removed->garbage_bytes += (size_t)(self->indices->a[i + 1] - self->indices->a[i]);
+    return true;
+}
+
+/*
+Removes string i in O(1) by marking it in the tombstone bitmap. Removed strings read as
+NULL from get_string and are skipped by map, filter, extend, to_strings and save; views
+and raw offsets still see them until the next compact. Once removed strings take up more
+than the max garbage ratio of str, the array is compacted, which renumbers the strings
+after them. Returns false if i is out of range or already removed.
+*/
+static bool CSTRING_ARRAY_FUNC(remove)(CSTRING_ARRAY_NAME *self, size_t i) {
+    if (i >= CSTRING_ARRAY_FUNC(num_strings)(self) || CSTRING_ARRAY_FUNC(is_removed)(self, i)) return false;
+    if (!CSTRING_ARRAY_FUNC(mark_removed)(self, i)) return false;
+    CSTRING_ARRAY_FUNC(maybe_compact)(self);
+    return true;
+}
+
+// Removes every string for which pred is true, compacting at most once, and returns how many were removed
+static size_t CSTRING_ARRAY_FUNC(remove_if)(CSTRING_ARRAY_NAME *self, cstring_array_filter_func pred, void *data) {
+    size_t n = CSTRING_ARRAY_FUNC(num_strings)(self);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len;
+        const char *str = CSTRING_ARRAY_FUNC(get_string_len)(self, i, &len);
+        if (str == NULL || !pred(str, len, data)) continue;
+        if (!CSTRING_ARRAY_FUNC(mark_removed)(self, i)) break;
+        count++;
+    }
+    if (count > 0) CSTRING_ARRAY_FUNC(maybe_compact)(self);
+    return count;
+}
+
+static inline void CSTRING_ARRAY_FUNC(append_string_len)(CSTRING_ARRAY_NAME *self, char *str, size_t len) {
+    // Plus the uncounted NUL that keeps the token terminated while it's open
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(self, self->str->n + len + 1)) return;
+    memcpy(self->str->a + self->str->n, str, len);
+    self->str->n += len;
+    CSTRING_ARRAY_STATS_ADD(bytes_added, len);
+    CSTRING_ARRAY_FUNC(update_end)(self);
+}
+
+static inline void CSTRING_ARRAY_FUNC(append_string)(CSTRING_ARRAY_NAME *self, char *str) {
+    CSTRING_ARRAY_FUNC(append_string_len)(self, str, strlen(str));
+}
+
+// Appends to the current token, replacing its terminator if it already has one
+static inline void CSTRING_ARRAY_FUNC(cat_string_len)(CSTRING_ARRAY_NAME *self, char *str, size_t len) {
+    CHAR_ARRAY_NAME *chars = self->str;
+    // An empty token's preceding NUL belongs to the previous string
+    size_t start = self->indices->n > 0 ? (size_t)self->indices->a[self->indices->n - 1] : 0;
+    if (chars->n > start && chars->a[chars->n - 1] == '\0') {
+        chars->n--;
+    }
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(self, chars->n + len + 1)) return;
+    memcpy(chars->a + chars->n, str, len);
+    chars->n += len;
+    chars->a[chars->n++] = '\0';
+    CSTRING_ARRAY_STATS_ADD(bytes_added, len);
+    CSTRING_ARRAY_FUNC(update_end)(self);
+}
+
+static inline void CSTRING_ARRAY_FUNC(cat_string)(CSTRING_ARRAY_NAME *self, char *str) {
+    CSTRING_ARRAY_FUNC(cat_string_len)(self, str, strlen(str));
+}
+
+static inline int64_t CSTRING_ARRAY_FUNC(token_length)(CSTRING_ARRAY_NAME *self, size_t i) {
+    if (INVALID_INDEX(i, self->indices->n)) {
+        return -1;
+    }
+    return (int64_t)(self->indices->a[i + 1] - self->indices->a[i]) - 1;
+}
+
+/*
+Copies str into a new array, splitting at every match of separator. Matching is greedy
+from the left. Separators before the first non-separator byte are dropped, and after
+that every separator ends a token, so consecutive separators produce empty tokens unless
+ignore_consecutive is set. Each run between separators is found with one vectorized
+search and copied with one memcpy.
+*/
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_separator)(char *str, const cstring_array_separator *separator, bool ignore_consecutive, size_t *count) {
+    *count = 0;
+    CSTRING_ARRAY_STATS_TIMER(start_ns);
+    size_t len = strlen(str);
+    if (!CSTRING_ARRAY_FUNC(can_address)(len + 1)) return NULL;
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
+    if (array == NULL) return NULL;
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(array, len + 1) || !CSTRING_ARRAY_FUNC(reserve_indices)(array, 2)) {
+        CSTRING_ARRAY_FUNC(destroy)(array);
+        return NULL;
+    }
+
+    char *out = array->str->a;
+    INDEX_ARRAY_NAME *indices = array->indices;
+    indices->a[indices->n++] = 0;
+    size_t n = 0;
+    size_t pos = 0;
+    bool last_was_separator = false;
+    bool first_char = false;
+
+    /*
+    With a single-byte separator and every separator ending a token, the output is the
+    input minus its leading separators, with the rest turned into NULs. That's one memcpy
+    and a block scan over the copy, which beats a search per token when tokens are short.
+    */
+    if (separator->type == CSTRING_ARRAY_SEPARATOR_STRING && separator->match_len == 1 && !ignore_consecutive) {
+        char c = separator->num_bytes == 1 ? separator->bytes[0] : separator->separator[0];
+        while (pos < len && str[pos] == c) {
+            pos++;
+        }
+        n = len - pos;
+        memcpy(out, str + pos, n);
+        for (size_t i = 0; i < n; i += CSTRING_ARRAY_SCAN_BLOCK) {
+            uint64_t mask = n - i >= CSTRING_ARRAY_SCAN_BLOCK ? cstring_array_scan_mask64(out + i, c, c) : cstring_array_scan_mask_tail(out + i, n - i, c, c);
+            if (mask == 0) continue;
+            if (!CSTRING_ARRAY_FUNC(reserve_indices)(array, indices->n + CSTRING_ARRAY_SCAN_BLOCK + 1)) {
+                CSTRING_ARRAY_FUNC(destroy)(array);
+                return NULL;
+            }
+            CSTRING_ARRAY_INDEX_TYPE *a = indices->a;
+            size_t m = indices->n;
+            do {
+                size_t j = i + cstring_array_ctz64(mask);
+                out[j] = '\0';
+                a[m++] = (CSTRING_ARRAY_INDEX_TYPE)(j + 1);
+                mask &= mask - 1;
+            } while (mask);
+            indices->n = m;
+        }
+        pos = len;
+    }
+
+    while (pos < len) {
+        const char *match = cstring_array_separator_find(separator, str + pos, len - pos);
+        size_t run_end = match != NULL ? (size_t)(match - str) : len;
+        if (run_end > pos) {
+            memcpy(out + n, str + pos, run_end - pos);
+            n += run_end - pos;
+            last_was_separator = false;
+            first_char = true;
+        }
+        if (match == NULL) break;
+
+        if (first_char && (!ignore_consecutive || !last_was_separator)) {
+            out[n++] = '\0';
+            if (!CSTRING_ARRAY_FUNC(reserve_indices)(array, indices->n + 2)) {
+                CSTRING_ARRAY_FUNC(destroy)(array);
+                return NULL;
+            }
+            indices->a[indices->n++] = (CSTRING_ARRAY_INDEX_TYPE)n;
+        }
+        last_was_separator = true;
+        pos = run_end + separator->match_len;
+    }
+    out[n++] = '\0';
+    array->str->n = n;
+    indices->a[indices->n] = (CSTRING_ARRAY_INDEX_TYPE)n;
+
+    *count = CSTRING_ARRAY_FUNC(num_strings)(array);
+    CSTRING_ARRAY_STATS_SPLIT(start_ns, *count);
+    return array;
+}
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_options)(char *str, const char *separator, size_t separator_len, bool ignore_consecutive, size_t *count) {
+    cstring_array_separator sep;
+    cstring_array_separator_init(&sep, separator, separator_len);
+    return CSTRING_ARRAY_FUNC(split_separator)(str, &sep, ignore_consecutive, count);
+}
+
+// Splits on any one byte of set[0..set_len), e.g. ",;\t"
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_set_options)(char *str, const char *set, size_t set_len, bool ignore_consecutive, size_t *count) {
+    cstring_array_separator sep;
+    cstring_array_separator_init_set(&sep, set, set_len);
+    return CSTRING_ARRAY_FUNC(split_separator)(str, &sep, ignore_consecutive, count);
+}
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_set)(char *str, const char *set, size_t set_len, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_set_options)(str, set, set_len, false, count);
+}
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_set_ignore_consecutive)(char *str, const char *set, size_t set_len, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_set_options)(str, set, set_len, true, count);
+}
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split)(char *str, const char *separator, size_t separator_len, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_options)(str, separator, separator_len, false, count);
+}
+
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_ignore_consecutive)(char *str, const char *separator, size_t separator_len, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_options)(str, separator, separator_len, true, count);
+}
+
+
+#ifdef CSTRING_ARRAY_HAVE_THREADS
+
+typedef struct {
+    const char *str;
+    size_t len;
+    const char *separator;
+    size_t separator_len;
+    bool ignore_consecutive;
+    bool first_chunk;
+    // Output: tokens NUL-delimited in result->str, the local start of every token after a NUL in result->indices
+    CSTRING_ARRAY_NAME *result;
+    // Separators emitted as empty tokens before the chunk's first non-separator byte
+    size_t leading;
+    bool has_chars;
+} CSTRING_ARRAY_TYPE(split_chunk);
+
+/*
+Runs the split_options state machine over one chunk. Every chunk after the first
+starts right after a separator, and is processed as if a non-separator byte had been
+seen before it. When that turns out to be false for the input as a whole, the leading
+empty tokens it emitted are dropped while stitching.
+*/
+static void *CSTRING_ARRAY_FUNC(split_chunk_run)(void *arg) {
+    CSTRING_ARRAY_TYPE(split_chunk) *chunk = arg;
+    const char *str = chunk->str;
+    const char *end = str + chunk->len;
+    const char *separator = chunk->separator;
+    size_t separator_len = chunk->separator_len;
+
+    CSTRING_ARRAY_NAME *result = chunk->result;
+    if (!CSTRING_ARRAY_FUNC(reserve_str)(result, chunk->len + 1)) goto exit_split_chunk;
+    char *out = result->str->a;
+    size_t n = 0;
+
+    bool first_char = !chunk->first_chunk;
+    bool last_was_separator = !chunk->first_chunk;
+
+    while (str < end) {
+        const char *sep = cstring_array_find_separator(str, (size_t)(end - str), separator, separator_len);
+        const char *run_end = sep != NULL ? sep : end;
+        if (run_end > str) {
+            memcpy(out + n, str, (size_t)(run_end - str));
+            n += (size_t)(run_end - str);
+            first_char = true;
+            last_was_separator = false;
+            chunk->has_chars = true;
+        }
+        if (sep == NULL) break;
+
+        if (first_char && (!chunk->ignore_consecutive || !last_was_separator)) {
+            out[n++] = '\0';
+            INDEX_ARRAY_NAME *indices = result->indices;
+            if (!CSTRING_ARRAY_FUNC(reserve_indices)(result, indices->n + 1)) goto exit_split_chunk;
+            indices->a[indices->n++] = (CSTRING_ARRAY_INDEX_TYPE)n;
+            if (!chunk->has_chars) chunk->leading++;
+        }
+        last_was_separator = true;
+        str = sep + separator_len;
+    }
+    result->str->n = n;
+    return NULL;
+
+exit_split_chunk:
+    // A NULL result fails the whole split
+    CSTRING_ARRAY_FUNC(destroy)(result);
+    chunk->result = NULL;
+    return NULL;
+}
+
+/*
+Multi-threaded split_options for large inputs. The input is cut into nthreads chunks,
+each ending right after a separator occurrence, so no separator straddles two chunks.
+Every chunk is split into its own cstring_array by a worker thread, then the pieces are
+stitched together with a prefix sum over their sizes: one memcpy per chunk and a single
+pass adding the chunk's base to its offsets.
+
+The output is identical to split_options. Separators that can overlap themselves
+(e.g. "aa") make the greedy left-to-right match depend on everything before it, so
+those inputs, short inputs and single-threaded calls just use split_options.
+*/
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_parallel_options)(char *str, const char *separator, size_t separator_len, bool ignore_consecutive, size_t nthreads, size_t *count) {
+    *count = 0;
+    size_t len = strlen(str);
+    if (!CSTRING_ARRAY_FUNC(can_address)(len + 1)) return NULL;
+
+    if (nthreads > len / CSTRING_ARRAY_PARALLEL_MIN_CHUNK) {
+        nthreads = len / CSTRING_ARRAY_PARALLEL_MIN_CHUNK;
+    }
+    if (nthreads <= 1 || separator_len == 0 || cstring_array_separator_self_overlaps(separator, separator_len)) {
+        return CSTRING_ARRAY_FUNC(split_options)(str, separator, separator_len, ignore_consecutive, count);
+    }
+    CSTRING_ARRAY_STATS_TIMER(start_ns);
+
+    CSTRING_ARRAY_TYPE(split_chunk) *chunks = calloc(nthreads, sizeof(CSTRING_ARRAY_TYPE(split_chunk)));
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    bool *started = calloc(nthreads, sizeof(bool));
+    CSTRING_ARRAY_NAME *string_array = NULL;
+    if (chunks == NULL || threads == NULL || started == NULL) goto exit_split_parallel;
+
+    size_t start = 0;
+    for (size_t k = 0; k < nthreads; k++) {
+        size_t end = len;
+        if (k < nthreads - 1) {
+            size_t target = len / nthreads * (k + 1);
+            if (target < start) target = start;
+            const char *sep = cstring_array_find_separator(str + target, len - target, separator, separator_len);
+            end = sep != NULL ? (size_t)(sep - str) + separator_len : len;
+        }
+        chunks[k].str = str + start;
+        chunks[k].len = end - start;
+        chunks[k].separator = separator;
+        chunks[k].separator_len = separator_len;
+        chunks[k].ignore_consecutive = ignore_consecutive;
+        chunks[k].first_chunk = k == 0;
+        chunks[k].result = CSTRING_ARRAY_FUNC(new)();
+        if (chunks[k].result == NULL) goto exit_split_parallel;
+        start = end;
+    }
+
+    for (size_t k = 0; k < nthreads; k++) {
+        started[k] = pthread_create(&threads[k], NULL, CSTRING_ARRAY_FUNC(split_chunk_run), &chunks[k]) == 0;
+        if (!started[k]) {
+            CSTRING_ARRAY_FUNC(split_chunk_run)(&chunks[k]);
+        }
+    }
+    for (size_t k = 0; k < nthreads; k++) {
+        if (started[k]) pthread_join(threads[k], NULL);
+    }
+
+    size_t total_bytes = 0;
+    size_t total_strings = 1;
+    bool seen_char = false;
+    for (size_t k = 0; k < nthreads; k++) {
+        if (chunks[k].result == NULL) goto exit_split_parallel;
+        size_t skip = seen_char ? 0 : chunks[k].leading;
+        total_bytes += chunks[k].result->str->n - skip;
+        total_strings += chunks[k].result->indices->n - skip;
+        seen_char = seen_char || chunks[k].has_chars;
+    }
+
+    string_array = CSTRING_ARRAY_FUNC(new_size)(total_bytes + 1);
+    if (string_array == NULL) goto exit_split_parallel;
+    if (string_array->str->m < total_bytes + 1 || !CSTRING_ARRAY_FUNC(reserve_indices)(string_array, total_strings + 1)) {
+        CSTRING_ARRAY_FUNC(destroy)(string_array);
+        string_array = NULL;
+        goto exit_split_parallel;
+    }
+
+    char *out = string_array->str->a;
+    CSTRING_ARRAY_INDEX_TYPE *indices = string_array->indices->a;
+    size_t base = 0;
+    size_t num_indices = 0;
+    indices[num_indices++] = 0;
+    seen_char = false;
+
+    for (size_t k = 0; k < nthreads; k++) {
+        CSTRING_ARRAY_NAME *result = chunks[k].result;
+        size_t skip = seen_char ? 0 : chunks[k].leading;
+        size_t chunk_bytes = result->str->n - skip;
+        memcpy(out + base, result->str->a + skip, chunk_bytes);
+
+        size_t local_n = result->indices->n - skip;
+        CSTRING_ARRAY_FUNC(rebase_offsets)(indices + num_indices, result->indices->a + skip, local_n, (CSTRING_ARRAY_INDEX_TYPE)(base - skip));
+        num_indices += local_n;
+
+        base += chunk_bytes;
+        seen_char = seen_char || chunks[k].has_chars;
+    }
+    out[base++] = '\0';
+    string_array->str->n = base;
+    string_array->indices->n = num_indices;
+    indices[num_indices] = (CSTRING_ARRAY_INDEX_TYPE)base;
+    *count = num_indices;
+    CSTRING_ARRAY_STATS_SPLIT(start_ns, num_indices);
+
+exit_split_parallel:
+    if (chunks != NULL) {
+        for (size_t k = 0; k < nthreads; k++) {
+            CSTRING_ARRAY_FUNC(destroy)(chunks[k].result);
+        }
+    }
+    free(chunks);
+    free(threads);
+    free(started);
+    return string_array;
+}
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_parallel)(char *str, const char *separator, size_t separator_len, size_t nthreads, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_parallel_options)(str, separator, separator_len, false, nthreads, count);
+}
+
+#endif
+
+typedef struct {
+    CSTRING_ARRAY_NAME *src;
+    size_t start;
+    size_t end;
+    // Exactly one of map and filter is set
+    cstring_array_map_func map;
+    cstring_array_filter_func filter;
+    void *data;
+    CSTRING_ARRAY_NAME *result;
+    bool ok;
+} CSTRING_ARRAY_TYPE(transform_job);
+
+static bool CSTRING_ARRAY_FUNC(map_range)(CSTRING_ARRAY_TYPE(transform_job) *job) {
+    CSTRING_ARRAY_NAME *result = job->result;
+    for (size_t i = job->start; i < job->end; i++) {
+        size_t len;
+        const char *str = CSTRING_ARRAY_FUNC(get_string_len)(job->src, i, &len);
+        if (str == NULL) continue;
+        if (CSTRING_ARRAY_FUNC(start_token)(result) == CSTRING_ARRAY_INDEX_MAX) return false;
+        // Most transforms don't grow their input, so len bytes are tried first
+        if (!CSTRING_ARRAY_FUNC(reserve_str)(result, result->str->n + len + 1)) return false;
+        size_t size = result->str->m - result->str->n - 1;
+        int64_t out_len = job->map(str, len, result->str->a + result->str->n, size, job->data);
+        if (out_len < 0) return false;
+        if ((size_t)out_len > size) {
+            if (!CSTRING_ARRAY_FUNC(reserve_str)(result, result->str->n + (size_t)out_len + 1)) return false;
+            size = result->str->m - result->str->n - 1;
+            out_len = job->map(str, len, result->str->a + result->str->n, size, job->data);
+            if (out_len < 0 || (size_t)out_len > size) return false;
+        }
+        result->str->n += (size_t)out_len;
+        CSTRING_ARRAY_FUNC(terminate)(result);
+    }
+    return true;
+}
+
+static bool CSTRING_ARRAY_FUNC(filter_range)(CSTRING_ARRAY_TYPE(transform_job) *job) {
+    // Runs of kept strings are copied with one extend_range each
+    size_t run_start = job->start;
+    for (size_t i = job->start; i < job->end; i++) {
+        size_t len;
+        const char *str = CSTRING_ARRAY_FUNC(get_string_len)(job->src, i, &len);
+        // extend_range skips removed strings by itself
+        if (str == NULL || job->filter(str, len, job->data)) continue;
+        if (!CSTRING_ARRAY_FUNC(extend_range)(job->result, job->src, run_start, i)) return false;
+        run_start = i + 1;
+    }
+    return CSTRING_ARRAY_FUNC(extend_range)(job->result, job->src, run_start, job->end);
+}
+
+static void *CSTRING_ARRAY_FUNC(transform_run)(void *arg) {
+    CSTRING_ARRAY_TYPE(transform_job) *job = arg;
+    size_t bytes = (size_t)(job->src->indices->a[job->end] - job->src->indices->a[job->start]);
+    job->result = CSTRING_ARRAY_FUNC(new_size)(bytes + 1);
+    if (job->result == NULL) return NULL;
+    job->ok = job->map != NULL ? CSTRING_ARRAY_FUNC(map_range)(job) : CSTRING_ARRAY_FUNC(filter_range)(job);
+    return NULL;
+}
+
+// First string starting at or after byte offset
+static inline size_t CSTRING_ARRAY_FUNC(string_at_byte)(CSTRING_ARRAY_NAME *self, size_t offset) {
+    size_t lo = 0, hi = CSTRING_ARRAY_FUNC(num_strings)(self);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((size_t)self->indices->a[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+Shared driver for map and filter. The strings are cut into up to nthreads ranges of
+roughly equal byte volume, found by binary searching the offsets, so a few long strings
+don't leave one thread with most of the work. Each range is transformed into its own
+array by a worker thread, and the pieces are concatenated with extend, which copies
+each piece's bytes once and rebases its offsets. Inputs under
+CSTRING_ARRAY_PARALLEL_MIN_CHUNK bytes per thread use fewer threads, down to running
+in the calling thread.
+*/
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(transform)(CSTRING_ARRAY_NAME *self, cstring_array_map_func map, cstring_array_filter_func filter, void *data, size_t nthreads) {
+    if (self == NULL) return NULL;
+    size_t n = CSTRING_ARRAY_FUNC(num_strings)(self);
+    size_t total = self->str->n;
+#ifndef CSTRING_ARRAY_HAVE_THREADS
+    nthreads = 1;
+#endif
+    if (nthreads > total / CSTRING_ARRAY_PARALLEL_MIN_CHUNK) nthreads = total / CSTRING_ARRAY_PARALLEL_MIN_CHUNK;
+    if (nthreads > n) nthreads = n;
+    if (nthreads == 0) nthreads = 1;
+
+    CSTRING_ARRAY_TYPE(transform_job) *jobs = calloc(nthreads, sizeof(CSTRING_ARRAY_TYPE(transform_job)));
+    if (jobs == NULL) return NULL;
+    size_t start = 0;
+    for (size_t k = 0; k < nthreads; k++) {
+        size_t end = k < nthreads - 1 ? CSTRING_ARRAY_FUNC(string_at_byte)(self, total / nthreads * (k + 1)) : n;
+        if (end < start) end = start;
+        jobs[k] = (CSTRING_ARRAY_TYPE(transform_job)){self, start, end, map, filter, data, NULL, false};
+        start = end;
+    }
+
+#ifdef CSTRING_ARRAY_HAVE_THREADS
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    bool *started = calloc(nthreads, sizeof(bool));
+    if (threads != NULL && started != NULL) {
+        for (size_t k = 1; k < nthreads; k++) {
+            started[k] = pthread_create(&threads[k], NULL, CSTRING_ARRAY_FUNC(transform_run), &jobs[k]) == 0;
+        }
+    }
+    // The calling thread takes the first range, and any range a thread couldn't be started for
+    for (size_t k = 0; k < nthreads; k++) {
+        if (started == NULL || !started[k]) CSTRING_ARRAY_FUNC(transform_run)(&jobs[k]);
+    }
+    for (size_t k = 1; k < nthreads; k++) {
+        if (started != NULL && started[k]) pthread_join(threads[k], NULL);
+    }
+    free(threads);
+    free(started);
+#else
+    CSTRING_ARRAY_FUNC(transform_run)(&jobs[0]);
+#endif
+
+    CSTRING_ARRAY_NAME *result = NULL;
+    size_t total_bytes = 0;
+    size_t total_strings = 0;
+    for (size_t k = 0; k < nthreads; k++) {
+        if (!jobs[k].ok) goto exit_transform;
+        total_bytes += jobs[k].result->str->n;
+        total_strings += CSTRING_ARRAY_FUNC(num_strings)(jobs[k].result);
+    }
+
+    if (nthreads == 1) {
+        result = jobs[0].result;
+        jobs[0].result = NULL;
+        goto exit_transform;
+    }
+
+    result = CSTRING_ARRAY_FUNC(new_size)(total_bytes + 1);
+    if (result == NULL) goto exit_transform;
+    if (result->str->m < total_bytes + 1 || !CSTRING_ARRAY_FUNC(reserve_indices)(result, total_strings + 1)) {
+        CSTRING_ARRAY_FUNC(destroy)(result);
+        result = NULL;
+        goto exit_transform;
+    }
+    for (size_t k = 0; k < nthreads; k++) {
+        CSTRING_ARRAY_FUNC(extend)(result, jobs[k].result);
+    }
+
+exit_transform:
+    for (size_t k = 0; k < nthreads; k++) {
+        CSTRING_ARRAY_FUNC(destroy)(jobs[k].result);
+    }
+    free(jobs);
+    return result;
+}
+
+/*
+New array holding fn applied to every string of self, in order, using up to nthreads
+threads. fn is called concurrently and must be thread-safe. Returns NULL if fn fails
+or on allocation failure.
+*/
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(map)(CSTRING_ARRAY_NAME *self, cstring_array_map_func fn, void *data, size_t nthreads) {
+    return CSTRING_ARRAY_FUNC(transform)(self, fn, NULL, data, nthreads);
+}
+
+// New array holding the strings of self for which pred is true, in order
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(filter)(CSTRING_ARRAY_NAME *self, cstring_array_filter_func pred, void *data, size_t nthreads) {
+    return CSTRING_ARRAY_FUNC(transform)(self, NULL, pred, data, nthreads);
+}
+
+// Whether string i of a and string j of b are equal. The lengths come from the offsets, so only equal-length strings reach memcmp
+static inline bool CSTRING_ARRAY_FUNC(strings_equal)(CSTRING_ARRAY_NAME *a, size_t i, CSTRING_ARRAY_NAME *b, size_t j) {
+    const CSTRING_ARRAY_INDEX_TYPE *a_offsets = a->indices->a;
+    const CSTRING_ARRAY_INDEX_TYPE *b_offsets = b->indices->a;
+    size_t len = (size_t)(a_offsets[i + 1] - a_offsets[i]);
+    if (len != (size_t)(b_offsets[j + 1] - b_offsets[j])) return false;
+    return memcmp(a->str->a + a_offsets[i], b->str->a + b_offsets[j], len - 1) == 0;
+}
+
+/*
+Whether a and b hold the same strings in the same order, ignoring removed ones. Two
+arrays with no removed strings and the same layout are decided by one memcmp of the
+offsets and one of the pools; otherwise strings are compared pairwise, lengths first.
+*/
+static bool CSTRING_ARRAY_FUNC(equals)(CSTRING_ARRAY_NAME *a, CSTRING_ARRAY_NAME *b) {
+    if (a == b) return true;
+    if (a == NULL || b == NULL) return false;
+    size_t a_n = CSTRING_ARRAY_FUNC(num_strings)(a);
+    size_t b_n = CSTRING_ARRAY_FUNC(num_strings)(b);
+
+    if (CSTRING_ARRAY_FUNC(num_removed)(a) == 0 && CSTRING_ARRAY_FUNC(num_removed)(b) == 0) {
+        if (a_n != b_n) return false;
+        if (a->str->n == b->str->n &&
+            memcmp(a->indices->a, b->indices->a, (a_n + 1) * sizeof(CSTRING_ARRAY_INDEX_TYPE)) == 0 &&
+            memcmp(a->str->a, b->str->a, a->str->n) == 0) {
+            return true;
+        }
+        for (size_t i = 0; i < a_n; i++) {
+            if (!CSTRING_ARRAY_FUNC(strings_equal)(a, i, b, i)) return false;
+        }
+        return true;
+    }
+
+    size_t i = 0, j = 0;
+    while (true) {
+        while (i < a_n && CSTRING_ARRAY_FUNC(is_removed)(a, i)) i++;
+        while (j < b_n && CSTRING_ARRAY_FUNC(is_removed)(b, j)) j++;
+        if (i == a_n || j == b_n) return i == a_n && j == b_n;
+        if (!CSTRING_ARRAY_FUNC(strings_equal)(a, i, b, j)) return false;
+        i++;
+        j++;
+    }
+}
+
+typedef struct {
+    CSTRING_ARRAY_NAME *a;
+    CSTRING_ARRAY_NAME *b;
+    const cstring_array_join_slot *slots;
+    size_t mask;
+    size_t start;
+    size_t end;
+    // intersect collects index pairs, diff collects the ids of a with no match
+    bool diff;
+    void *out;
+    size_t n;
+    size_t m;
+    bool ok;
+} CSTRING_ARRAY_TYPE(join_job);
+
+static bool CSTRING_ARRAY_FUNC(join_push)(CSTRING_ARRAY_TYPE(join_job) *job, const void *item, size_t size) {
+    if (job->n == job->m) {
+        size_t m = job->m > 0 ? job->m * 2 : 64;
+        void *out = realloc(job->out, m * size);
+        if (out == NULL) return false;
+        job->out = out;
+        job->m = m;
+    }
+    memcpy((char *)job->out + job->n * size, item, size);
+    job->n++;
+    return true;
+}
+
+// Probes the table with strings [start, end) of a
+static void *CSTRING_ARRAY_FUNC(join_run)(void *arg) {
+    CSTRING_ARRAY_TYPE(join_job) *job = arg;
+    CSTRING_ARRAY_NAME *a = job->a;
+    const CSTRING_ARRAY_INDEX_TYPE *offsets = a->indices->a;
+    const cstring_array_join_slot *slots = job->slots;
+
+    for (size_t i = job->start; i < job->end; i++) {
+        if (CSTRING_ARRAY_FUNC(is_removed)(a, i)) continue;
+        uint64_t hash = cstring_array_hash(a->str->a + offsets[i], (size_t)(offsets[i + 1] - offsets[i]) - 1, 0);
+        bool found = false;
+        // Equal strings of b sit in one probe run in insertion order, so pairs come out sorted
+        for (size_t k = hash & job->mask; slots[k].id != 0; k = (k + 1) & job->mask) {
+            if (slots[k].hash != hash || !CSTRING_ARRAY_FUNC(strings_equal)(a, i, job->b, slots[k].id - 1)) continue;
+            found = true;
+            if (job->diff) break;
+            cstring_array_index_pair pair = {i, slots[k].id - 1};
+            if (!CSTRING_ARRAY_FUNC(join_push)(job, &pair, sizeof(pair))) return NULL;
+        }
+        if (job->diff && !found && !CSTRING_ARRAY_FUNC(join_push)(job, &i, sizeof(i))) return NULL;
+    }
+    job->ok = true;
+    return NULL;
+}
+
+/*
+Shared driver for intersect and diff, a hash join: b's strings go into an
+open-addressing table keyed by cstring_array_hash, and a's strings probe it, comparing
+the stored hash, then the lengths, then the bytes. The probes are split across up to
+nthreads threads by byte volume, as in transform, and each thread's matches are
+concatenated in order at the end.
+*/
+static void *CSTRING_ARRAY_FUNC(join)(CSTRING_ARRAY_NAME *a, CSTRING_ARRAY_NAME *b, bool diff, size_t nthreads, size_t *count) {
+    *count = 0;
+    if (a == NULL || b == NULL) return NULL;
+    size_t n = CSTRING_ARRAY_FUNC(num_strings)(a);
+    size_t b_n = CSTRING_ARRAY_FUNC(num_strings)(b);
+    size_t size = diff ? sizeof(size_t) : sizeof(cstring_array_index_pair);
+
+    // At most half full, so probe runs stay short
+    size_t live = b_n - CSTRING_ARRAY_FUNC(num_removed)(b);
+    size_t num_slots = 16;
+    while (num_slots < live * 2) num_slots *= 2;
+    cstring_array_join_slot *slots = calloc(num_slots, sizeof(cstring_array_join_slot));
+    if (slots == NULL) return NULL;
+    size_t mask = num_slots - 1;
+    for (size_t j = 0; j < b_n; j++) {
+        size_t len;
+        const char *str = CSTRING_ARRAY_FUNC(get_string_len)(b, j, &len);
+        if (str == NULL) continue;
+        uint64_t hash = cstring_array_hash(str, len, 0);
+        size_t k = hash & mask;
+        while (slots[k].id != 0) k = (k + 1) & mask;
+        slots[k].hash = hash;
+        slots[k].id = j + 1;
+    }
+
+    size_t total = a->str->n;
+#ifndef CSTRING_ARRAY_HAVE_THREADS
+    nthreads = 1;
+#endif
+    if (nthreads > total / CSTRING_ARRAY_PARALLEL_MIN_CHUNK) nthreads = total / CSTRING_ARRAY_PARALLEL_MIN_CHUNK;
+    if (nthreads > n) nthreads = n;
+    if (nthreads == 0) nthreads = 1;
+
+    void *result = NULL;
+    CSTRING_ARRAY_TYPE(join_job) *jobs = calloc(nthreads, sizeof(CSTRING_ARRAY_TYPE(join_job)));
+    if (jobs == NULL) goto exit_join;
+    size_t start = 0;
+    for (size_t k = 0; k < nthreads; k++) {
+        size_t end = k < nthreads - 1 ? CSTRING_ARRAY_FUNC(string_at_byte)(a, total / nthreads * (k + 1)) : n;
+        if (end < start) end = start;
+        jobs[k] = (CSTRING_ARRAY_TYPE(join_job)){a, b, slots, mask, start, end, diff, NULL, 0, 0, false};
+        start = end;
+    }
+
+#ifdef CSTRING_ARRAY_HAVE_THREADS
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    bool *started = calloc(nthreads, sizeof(bool));
+    if (threads != NULL && started != NULL) {
+        for (size_t k = 1; k < nthreads; k++) {
+            started[k] = pthread_create(&threads[k], NULL, CSTRING_ARRAY_FUNC(join_run), &jobs[k]) == 0;
+        }
+    }
+    for (size_t k = 0; k < nthreads; k++) {
+        if (started == NULL || !started[k]) CSTRING_ARRAY_FUNC(join_run)(&jobs[k]);
+    }
+    for (size_t k = 1; k < nthreads; k++) {
+        if (started != NULL && started[k]) pthread_join(threads[k], NULL);
+    }
+    free(threads);
+    free(started);
+#else
+    CSTRING_ARRAY_FUNC(join_run)(&jobs[0]);
+#endif
+
+    size_t total_n = 0;
+    for (size_t k = 0; k < nthreads; k++) {
+        if (!jobs[k].ok) goto exit_join;
+        total_n += jobs[k].n;
+    }
+    // Never NULL on success, even when empty
+    result = malloc(total_n > 0 ? total_n * size : size);
+    if (result == NULL) goto exit_join;
+    size_t pos = 0;
+    for (size_t k = 0; k < nthreads; k++) {
+        if (jobs[k].n > 0) memcpy((char *)result + pos * size, jobs[k].out, jobs[k].n * size);
+        pos += jobs[k].n;
+    }
+    *count = total_n;
+
+exit_join:
+    if (jobs != NULL) {
+        for (size_t k = 0; k < nthreads; k++) {
+            free(jobs[k].out);
+        }
+    }
+    free(jobs);
+    free(slots);
+    return result;
+}
+
+/*
+Every pair of equal strings, a's index first, sorted by a's index and then b's, using
+up to nthreads threads. Returns a malloc'd array of *count pairs, or NULL on allocation
+failure. Removed strings don't match.
+*/
+static inline cstring_array_index_pair *CSTRING_ARRAY_FUNC(intersect)(CSTRING_ARRAY_NAME *a, CSTRING_ARRAY_NAME *b, size_t nthreads, size_t *count) {
+    return CSTRING_ARRAY_FUNC(join)(a, b, false, nthreads, count);
+}
+
+// Sorted indices of the live strings of a that equal no string of b, malloc'd, as with intersect
+static inline size_t *CSTRING_ARRAY_FUNC(diff)(CSTRING_ARRAY_NAME *a, CSTRING_ARRAY_NAME *b, size_t nthreads, size_t *count) {
+    return CSTRING_ARRAY_FUNC(join)(a, b, true, nthreads, count);
+}
+
+/*
+ASCII case conversion in place. Terminators aren't letters, so the whole byte pool is
+converted in one vector pass instead of string by string. Bytes >= 0x80 are left alone.
+*/
+static inline void CSTRING_ARRAY_FUNC(lower)(CSTRING_ARRAY_NAME *self) {
+    cstring_array_ascii_lower(self->str->a, self->str->n);
+}
+
+static inline void CSTRING_ARRAY_FUNC(upper)(CSTRING_ARRAY_NAME *self) {
+    cstring_array_ascii_upper(self->str->a, self->str->n);
+}
+
+/*
+Strips leading and trailing whitespace from every string in place, compacting str.
+Removed strings are cut down to their terminators, which is all the garbage they then
+count for.
+*/
+static void CSTRING_ARRAY_FUNC(trim)(CSTRING_ARRAY_NAME *self) {
+    size_t n = CSTRING_ARRAY_FUNC(num_strings)(self);
+    char *a = self->str->a;
+    CSTRING_ARRAY_INDEX_TYPE *indices = self->indices->a;
+    size_t out = 0;
+    size_t garbage_bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t start = indices[i];
+        size_t end = indices[i + 1] - 1;
+        if (CSTRING_ARRAY_FUNC(is_removed)(self, i)) {
+            start = end;
+            garbage_bytes++;
+        }
+        while (start < end && cstring_array_is_space(a[start])) start++;
+        while (end > start && cstring_array_is_space(a[end - 1])) end--;
+
+        indices[i] = (CSTRING_ARRAY_INDEX_TYPE)out;
+        memmove(a + out, a + start, end - start);
+        out += end - start;
+        a[out++] = '\0';
+    }
+    self->str->n = out;
+    CSTRING_ARRAY_FUNC(update_end)(self);
+    if (self->removed != NULL) self->removed->garbage_bytes = garbage_bytes;
+}
+
+// Wraps str[0..len] and the token offsets found in it by split_no_copy(_set) in an array
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(no_copy_finish)(char *str, size_t len, INDEX_ARRAY_NAME *indices, size_t *count) {
+    // The terminator at str[len] ends the last token, unless a separator in the final
+    // position already did, in which case it's left out
+    size_t size = len + 1;
+    if (indices->n > 1 && indices->a[indices->n - 1] == len) {
+        indices->n--;
+        size = len;
+    }
+
+    if (len == 0) {
+        INDEX_ARRAY_FUNC(destroy)(indices);
+        return CSTRING_ARRAY_FUNC(new)();
+    }
+
+    CSTRING_ARRAY_NAME *string_array = malloc(sizeof(CSTRING_ARRAY_NAME));
+    if (string_array == NULL) {
+        INDEX_ARRAY_FUNC(destroy)(indices);
+        return NULL;
+    }
+    string_array->indices = indices;
+    string_array->allocator = NULL;
+    string_array->removed = NULL;
+    string_array->str = CHAR_ARRAY_FUNC(from_string_no_copy)(str, size);
+    if (string_array->str == NULL || !CSTRING_ARRAY_FUNC(update_end)(string_array)) {
+        INDEX_ARRAY_FUNC(destroy)(indices);
+        free(string_array->str);
+        free(string_array);
+        return NULL;
+    }
+    *count = CSTRING_ARRAY_FUNC(num_strings)(string_array);
+
+    return string_array;
+}
+
+/*
+split_no_copy's block scan, which NULs each separator and records the offset after it.
+Kept out of line: inlined into a caller that can see str's allocation but not its
+length, the compiler flags the full-block loads as overrunning a short buffer.
+*/
+static CSTRING_ARRAY_NOINLINE bool CSTRING_ARRAY_FUNC(split_no_copy_scan)(CSTRING_ARRAY_NAME *scratch, char *str, size_t len, char separator) {
+    INDEX_ARRAY_NAME *indices = scratch->indices;
+    for (size_t i = 0; i < len; i += CSTRING_ARRAY_SCAN_BLOCK) {
+        uint64_t mask = len - i >= CSTRING_ARRAY_SCAN_BLOCK
+            ? cstring_array_scan_mask64(str + i, separator, separator)
+            : cstring_array_scan_mask_tail(str + i, len - i, separator, separator);
+        if (mask == 0) continue;
+        if (!CSTRING_ARRAY_FUNC(reserve_indices)(scratch, indices->n + CSTRING_ARRAY_SCAN_BLOCK)) return false;
+        CSTRING_ARRAY_INDEX_TYPE *a = indices->a;
+        size_t n = indices->n;
+        do {
+            size_t j = i + cstring_array_ctz64(mask);
+            str[j] = '\0';
+            a[n++] = (CSTRING_ARRAY_INDEX_TYPE)(j + 1);
+            mask &= mask - 1;
+        } while (mask);
+        indices->n = n;
+    }
+    return true;
+}
+
+/*
+Splits str in place: separators are rewritten to NUL and token offsets are recorded as
+they're found by the 64-byte block scan, so each block is tested for the separator
+once however many tokens it holds.
+*/
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_no_copy)(char *str, char separator, size_t *count) {
+    *count = 0;
+    CSTRING_ARRAY_STATS_TIMER(start_ns);
+    size_t len = strlen(str);
+    // Every offset stored below is at most len + 1
+    if (!CSTRING_ARRAY_FUNC(can_address)(len + 1)) return NULL;
+
+    INDEX_ARRAY_NAME *indices = INDEX_ARRAY_FUNC(new_size)(1);
+    if (indices == NULL) return NULL;
+    INDEX_ARRAY_FUNC(push)(indices, 0);
+    // The array struct doesn't exist until the tokens are found
+    CSTRING_ARRAY_NAME scratch = {.indices = indices};
+
+    if (!CSTRING_ARRAY_FUNC(split_no_copy_scan)(&scratch, str, len, separator)) {
+        INDEX_ARRAY_FUNC(destroy)(indices);
+        return NULL;
+    }
+
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(no_copy_finish)(str, len, indices, count);
+    if (array != NULL) CSTRING_ARRAY_STATS_SPLIT(start_ns, *count);
+    return array;
+}
+
+/*
+split_no_copy on any one byte of set[0..set_len): each of them is rewritten to NUL in
+place and ends a token. Only single-byte separators can be split without copying, as
+longer ones would leave gaps between the tokens.
+*/
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_no_copy_set)(char *str, const char *set, size_t set_len, size_t *count) {
+    if (set_len == 1) return CSTRING_ARRAY_FUNC(split_no_copy)(str, set[0], count);
+    *count = 0;
+    CSTRING_ARRAY_STATS_TIMER(start_ns);
+
+    cstring_array_separator separator;
+    cstring_array_separator_init_set(&separator, set, set_len);
+    size_t len = strlen(str);
+    if (!CSTRING_ARRAY_FUNC(can_address)(len + 1)) return NULL;
+
+    INDEX_ARRAY_NAME *indices = INDEX_ARRAY_FUNC(new_size)(1);
+    if (indices == NULL) return NULL;
+    INDEX_ARRAY_FUNC(push)(indices, 0);
+    CSTRING_ARRAY_NAME scratch = {.indices = indices};
+
+    size_t pos = 0;
+    const char *match;
+    while (pos < len && (match = cstring_array_separator_find(&separator, str + pos, len - pos)) != NULL) {
+        size_t j = (size_t)(match - str);
+        if (!CSTRING_ARRAY_FUNC(reserve_indices)(&scratch, indices->n + 1)) {
+            INDEX_ARRAY_FUNC(destroy)(indices);
+            return NULL;
+        }
+        str[j] = '\0';
+        indices->a[indices->n++] = (CSTRING_ARRAY_INDEX_TYPE)(j + 1);
+        pos = j + 1;
+    }
+
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(no_copy_finish)(str, len, indices, count);
+    if (array != NULL) CSTRING_ARRAY_STATS_SPLIT(start_ns, *count);
+    return array;
+}
+
+// Appends str[start..end) as a new string of column, if the column is projected
+static inline bool CSTRING_ARRAY_FUNC(add_field)(CSTRING_ARRAY_NAME **columns, size_t num_columns, size_t field, const char *str, size_t start, size_t end) {
+    if (field >= num_columns || columns[field] == NULL) return true;
+    return CSTRING_ARRAY_FUNC(add_string_len)(columns[field], (char *)str + start, end - start) != CSTRING_ARRAY_INDEX_MAX;
+}
+
+/*
+Splits the len bytes of str into records ending at record_separator, and each record
+into fields at field_separator, appending field i of every record to columns[i]. It's
+a columnar split for delimited logs and CSV/TSV without quoting: one pass over str, with
+both separators found by the same 64-byte block scan.
+
+columns holds num_columns arrays. A NULL entry leaves that field out, so it's never
+copied, and fields past num_columns are dropped. A record with fewer fields gets empty
+strings in the remaining columns, so string r of every column comes from record r. A
+record separator at the very end doesn't start another record. Columns are appended to,
+so consecutive buffers can be split into the same columns.
+
+Returns false if the separators are the same or on allocation failure, in which case
+the columns may hold part of the input. *num_records is the number of records split.
+*/
+static bool CSTRING_ARRAY_FUNC(split_records)(const char *str, size_t len, char field_separator, char record_separator,
+                                              CSTRING_ARRAY_NAME **columns, size_t num_columns, size_t *num_records) {
+    *num_records = 0;
+    if (field_separator == record_separator) return false;
+    CSTRING_ARRAY_STATS_TIMER(start_ns);
+
+    size_t field = 0;
+    size_t start = 0;
+    size_t records = 0;
+    // Every load stays inside str[0..len), see cstring_array_scan_mask_tail
+    for (size_t i = 0; i < len; i += CSTRING_ARRAY_SCAN_BLOCK) {
+        uint64_t mask = len - i >= CSTRING_ARRAY_SCAN_BLOCK
+            ? cstring_array_scan_mask64(str + i, field_separator, record_separator)
+            : cstring_array_scan_mask_tail(str + i, len - i, field_separator, record_separator);
+        while (mask != 0) {
+            size_t j = i + cstring_array_ctz64(mask);
+            mask &= mask - 1;
+            if (!CSTRING_ARRAY_FUNC(add_field)(columns, num_columns, field, str, start, j)) return false;
+            start = j + 1;
+            if (str[j] == field_separator) {
+                field++;
+                continue;
+            }
+            while (++field < num_columns) {
+                if (!CSTRING_ARRAY_FUNC(add_field)(columns, num_columns, field, str, j, j)) return false;
+            }
+            field = 0;
+            records++;
+        }
+    }
+
+    // The last record, unless the input ended with a record separator
+    if (start < len || field > 0) {
+        if (!CSTRING_ARRAY_FUNC(add_field)(columns, num_columns, field, str, start, len)) return false;
+        while (++field < num_columns) {
+            if (!CSTRING_ARRAY_FUNC(add_field)(columns, num_columns, field, str, len, len)) return false;
+        }
+        records++;
+    }
+
+    *num_records = records;
+    CSTRING_ARRAY_STATS_SPLIT(start_ns, records);
+    return true;
+}
+
+typedef bool (*CSTRING_ARRAY_TYPE(batch_callback))(CSTRING_ARRAY_NAME *batch, void *data);
+
+/*
+Splits everything read from source into self, with the same tokens as split_options.
+Chunks are read straight into the tail of self->str and tokenized in place: the
+tokenized output never gets ahead of the bytes read, so no other buffer is needed and
+peak memory is the output plus one chunk. A separator prefix at the end of a chunk is
+left in place until the next read says whether it's a separator.
+
+With a callback, every batch_size strings are handed to it as self, then dropped, so
+memory stays bounded by the batch. The final, possibly shorter, batch is always passed
+to the callback. The callback returns false to stop reading.
+
+Input is treated as text: a NUL byte in it ends the string it's in when read back.
+*/
+static bool CSTRING_ARRAY_FUNC(split_reader)(CSTRING_ARRAY_NAME *self, cstring_array_read_func read_func, void *source,
+                                             const char *separator, size_t separator_len,
+                                             const cstring_array_stream_options *options, size_t batch_size,
+                                             CSTRING_ARRAY_TYPE(batch_callback) callback, void *data) {
+    if (separator_len == 0) return false;
+    CSTRING_ARRAY_STATS_TIMER(start_ns);
+    size_t chunk_size = options != NULL && options->chunk_size > 0 ? options->chunk_size : CSTRING_ARRAY_STREAM_CHUNK_SIZE;
+    bool ignore_consecutive = options != NULL && options->ignore_consecutive;
+
+    CHAR_ARRAY_NAME *str = self->str;
+    INDEX_ARRAY_NAME *indices = self->indices;
+    str->n = 0;
+    indices->n = 0;
+    if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, 2)) return false;
+    indices->a[indices->n++] = 0;
+
+    // Tokenized output ends at write, unprocessed input is [pos, end)
+    size_t write = 0, pos = 0, end = 0;
+    bool last_was_separator = false;
+    bool first_char = false;
+    bool eof = false;
+
+    while (!eof) {
+        if (!CSTRING_ARRAY_FUNC(reserve_str)(self, end + chunk_size + 1)) return false;
+        int64_t got = read_func(source, str->a + end, chunk_size);
+        if (got < 0) return false;
+        eof = got == 0;
+        end += (size_t)got;
+        char *a = str->a;
+
+        while (pos < end) {
+            char *hit = memchr(a + pos, separator[0], end - pos);
+            size_t run = (hit != NULL ? (size_t)(hit - a) : end) - pos;
+            if (run > 0) {
+                if (write != pos) {
+                    memmove(a + write, a + pos, run);
+                }
+                write += run;
+                pos += run;
+                last_was_separator = false;
+                first_char = true;
+            }
+            if (hit == NULL) break;
+
+            size_t available = end - pos;
+            if (available < separator_len && !eof && memcmp(a + pos, separator, available) == 0) break;
+
+            if (available >= separator_len && memcmp(a + pos, separator, separator_len) == 0) {
+                pos += separator_len;
+                if (first_char && (!ignore_consecutive || !last_was_separator)) {
+                    a[write++] = '\0';
+                    // Offsets are stored directly, so each one is checked here
+                    if (!CSTRING_ARRAY_FUNC(can_address)(write)) return false;
+                    if (callback != NULL && indices->n == batch_size) {
+                        str->n = write;
+                        indices->a[indices->n] = (CSTRING_ARRAY_INDEX_TYPE)write;
+                        CSTRING_ARRAY_STATS_ADD(split_strings, indices->n);
+                        if (!callback(self, data)) {
+                            CSTRING_ARRAY_STATS_SPLIT(start_ns, 0);
+                            return true;
+                        }
+                        memmove(a, a + pos, end - pos);
+                        end -= pos;
+                        pos = 0;
+                        write = 0;
+                        indices->n = 0;
+                    }
+                    if (!CSTRING_ARRAY_FUNC(reserve_indices)(self, indices->n + 2)) return false;
+                    indices->a[indices->n++] = (CSTRING_ARRAY_INDEX_TYPE)write;
+                }
+                last_was_separator = true;
+            } else {
+                a[write++] = a[pos++];
+                last_was_separator = false;
+                first_char = true;
+            }
+        }
+    }
+
+    // The last read reserved room past end, and write never passes end
+    str->a[write++] = '\0';
+    if (!CSTRING_ARRAY_FUNC(can_address)(write)) return false;
+    str->n = write;
+    indices->a[indices->n] = (CSTRING_ARRAY_INDEX_TYPE)write;
+    CSTRING_ARRAY_STATS_SPLIT(start_ns, indices->n);
+    if (callback != NULL) {
+        callback(self, data);
+    }
+    return true;
+}
+
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_reader_new)(cstring_array_read_func read_func, void *source, const char *separator, size_t separator_len, const cstring_array_stream_options *options, size_t *count) {
+    *count = 0;
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
+    if (array == NULL) return NULL;
+    if (!CSTRING_ARRAY_FUNC(split_reader)(array, read_func, source, separator, separator_len, options, 0, NULL, NULL)) {
+        CSTRING_ARRAY_FUNC(destroy)(array);
+        return NULL;
+    }
+    *count = CSTRING_ARRAY_FUNC(num_strings)(array);
+    return array;
+}
+
+static bool CSTRING_ARRAY_FUNC(split_reader_batches)(cstring_array_read_func read_func, void *source, const char *separator, size_t separator_len, const cstring_array_stream_options *options, size_t batch_size, CSTRING_ARRAY_TYPE(batch_callback) callback, void *data) {
+    if (batch_size == 0 || callback == NULL) return false;
+    CSTRING_ARRAY_NAME *array = CSTRING_ARRAY_FUNC(new)();
+    if (array == NULL) return false;
+    bool ok = CSTRING_ARRAY_FUNC(split_reader)(array, read_func, source, separator, separator_len, options, batch_size, callback, data);
+    CSTRING_ARRAY_FUNC(destroy)(array);
+    return ok;
+}
+
+// Splits the rest of file without reading it into memory first. options may be NULL.
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_stream)(FILE *file, const char *separator, size_t separator_len, const cstring_array_stream_options *options, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_reader_new)(cstring_array_read_file, file, separator, separator_len, options, count);
+}
+
+static inline bool CSTRING_ARRAY_FUNC(split_stream_batches)(FILE *file, const char *separator, size_t separator_len, const cstring_array_stream_options *options, size_t batch_size, CSTRING_ARRAY_TYPE(batch_callback) callback, void *data) {
+    return CSTRING_ARRAY_FUNC(split_reader_batches)(cstring_array_read_file, file, separator, separator_len, options, batch_size, callback, data);
+}
+
+#ifdef CSTRING_ARRAY_HAVE_UNISTD
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(split_fd)(int fd, const char *separator, size_t separator_len, const cstring_array_stream_options *options, size_t *count) {
+    return CSTRING_ARRAY_FUNC(split_reader_new)(cstring_array_read_fd, &fd, separator, separator_len, options, count);
+}
+
+static inline bool CSTRING_ARRAY_FUNC(split_fd_batches)(int fd, const char *separator, size_t separator_len, const cstring_array_stream_options *options, size_t batch_size, CSTRING_ARRAY_TYPE(batch_callback) callback, void *data) {
+    return CSTRING_ARRAY_FUNC(split_reader_batches)(cstring_array_read_fd, &fd, separator, separator_len, options, batch_size, callback, data);
+}
+
+#endif
+
+// First string of the run of live strings at or after i, and the run's end in *run_end
+static inline size_t CSTRING_ARRAY_FUNC(next_live_run)(CSTRING_ARRAY_NAME *self, size_t i, size_t *run_end) {
+    size_t n = self->indices->n;
+    cstring_array_tombstones *removed = self->removed;
+    if (removed == NULL || removed->num_removed == 0) {
+        *run_end = n;
+        return i;
+    }
+    i = cstring_array_tombstones_find(removed, i, n, false);
+    *run_end = cstring_array_tombstones_find(removed, i, n, true);
+    return i;
+}
+
+/*
+Writes the array in the cstring_array_file_header format. Files are only readable by
+the instantiation with the same offset width (cstring_array and cstring_array_aligned
+share 32-bit offsets, cstring_array64 uses 64-bit ones). Removed strings are left out
+and self isn't modified: the file holds what compact would leave, with the live runs
+rebased as they're written and the checksum fed along the way.
+*/
+static bool CSTRING_ARRAY_FUNC(save)(CSTRING_ARRAY_NAME *self, const char *path) {
+    if (self == NULL || path == NULL) return false;
+
+    size_t n = self->indices->n;
+    const CSTRING_ARRAY_INDEX_TYPE *offsets = self->indices->a;
+    // Up to each run's end offset, so an open last string is saved with its terminator
+    size_t num_live = 0;
+    size_t str_size = 0;
+    size_t run_end;
+    for (size_t i = CSTRING_ARRAY_FUNC(next_live_run)(self, 0, &run_end); i < n; i = CSTRING_ARRAY_FUNC(next_live_run)(self, run_end, &run_end)) {
+        num_live += run_end - i;
+        str_size += offsets[run_end] - offsets[i];
+    }
+    size_t offsets_size = (num_live + 1) * sizeof(CSTRING_ARRAY_INDEX_TYPE);
+    CSTRING_ARRAY_INDEX_TYPE end = (CSTRING_ARRAY_INDEX_TYPE)str_size;
+
+    cstring_array_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CSTRING_ARRAY_FILE_MAGIC, sizeof(CSTRING_ARRAY_FILE_MAGIC));
+    header.version = CSTRING_ARRAY_FILE_VERSION;
+    header.byte_order_mark = CSTRING_ARRAY_FILE_BYTE_ORDER_MARK;
+    header.offset_size = (uint32_t)sizeof(CSTRING_ARRAY_INDEX_TYPE);
+    header.num_strings = num_live;
+    header.str_size = str_size;
+    header.offsets_pos = CSTRING_ARRAY_FILE_ALIGNMENT;
+    header.str_pos = header.offsets_pos + offsets_size + cstring_array_file_padding(offsets_size);
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return false;
+
+    // The checksum isn't known until everything is written, so the header goes in twice
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && cstring_array_file_write_padding(f, CSTRING_ARRAY_FILE_ALIGNMENT - sizeof(header));
+
+    cstring_array_hasher hasher;
+    cstring_array_hasher_init(&hasher, num_live * sizeof(CSTRING_ARRAY_INDEX_TYPE), 0);
+    size_t bytes_out = 0;
+    for (size_t i = CSTRING_ARRAY_FUNC(next_live_run)(self, 0, &run_end); ok && i < n; i = CSTRING_ARRAY_FUNC(next_live_run)(self, run_end, &run_end)) {
+        CSTRING_ARRAY_INDEX_TYPE delta = (CSTRING_ARRAY_INDEX_TYPE)(bytes_out - offsets[i]);
+        if (delta == 0) {
+            ok = cstring_array_file_write_hashed(f, &hasher, offsets + i, (run_end - i) * sizeof(CSTRING_ARRAY_INDEX_TYPE));
+        }
+        // Rebased through a small buffer, a chunk at a time
+        for (size_t j = i; ok && delta != 0 && j < run_end; j += CSTRING_ARRAY_SCAN_BLOCK) {
+            CSTRING_ARRAY_INDEX_TYPE chunk[CSTRING_ARRAY_SCAN_BLOCK];
+            size_t chunk_len = run_end - j < CSTRING_ARRAY_SCAN_BLOCK ? run_end - j : CSTRING_ARRAY_SCAN_BLOCK;
+            CSTRING_ARRAY_FUNC(rebase_offsets)(chunk, offsets + j, chunk_len, delta);
+            ok = cstring_array_file_write_hashed(f, &hasher, chunk, chunk_len * sizeof(CSTRING_ARRAY_INDEX_TYPE));
+        }
+        bytes_out += offsets[run_end] - offsets[i];
+    }
+    uint64_t checksum = cstring_array_hasher_final(&hasher);
+    checksum = cstring_array_hash(&end, sizeof(end), checksum);
+
+    ok = ok && fwrite(&end, sizeof(end), 1, f) == 1
+        && cstring_array_file_write_padding(f, cstring_array_file_padding(offsets_size));
+
+    cstring_array_hasher_init(&hasher, str_size, checksum);
+    for (size_t i = CSTRING_ARRAY_FUNC(next_live_run)(self, 0, &run_end); ok && i < n; i = CSTRING_ARRAY_FUNC(next_live_run)(self, run_end, &run_end)) {
+        ok = cstring_array_file_write_hashed(f, &hasher, self->str->a + offsets[i], offsets[run_end] - offsets[i]);
+    }
+    header.checksum = cstring_array_hasher_final(&hasher);
+
+    // Always at least one trailing NUL, so the last string is terminated even if str isn't
+    size_t str_padding = CSTRING_ARRAY_FILE_ALIGNMENT - str_size % CSTRING_ARRAY_FILE_ALIGNMENT;
+    ok = ok && cstring_array_file_write_padding(f, str_padding)
+        && fseek(f, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, f) == 1;
+
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
+
+#ifdef CSTRING_ARRAY_HAVE_MMAP
+
+static inline size_t CSTRING_ARRAY_FUNC(file_size)(const cstring_array_file_header *header) {
+    size_t end = (size_t)(header->str_pos + header->str_size);
+    return end + CSTRING_ARRAY_FILE_ALIGNMENT - end % CSTRING_ARRAY_FILE_ALIGNMENT;
+}
+
+/*
+Maps a file written by save and returns a read-only array whose indices and str point
+straight into the mapping: nothing is copied, and the pages are shared with every other
+process mapping the same file. The header, section bounds and offsets are always
+validated, which reads the offsets section once: every string must end before the next
+one starts and the last must end in a NUL, so no get_string can run off the mapping.
+verify_checksum also hashes the str section, reading the whole file.
+
+The result must be released with mmap_close, never destroy, and must not be modified.
+*/
+static CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(mmap_open_options)(const char *path, bool verify_checksum) {
+    if (path == NULL) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(cstring_array_file_header)) {
+        close(fd);
+        return NULL;
+    }
+    size_t file_size = (size_t)st.st_size;
+
+    char *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const cstring_array_file_header *header = (const cstring_array_file_header *)map;
+    size_t offset_size = sizeof(CSTRING_ARRAY_INDEX_TYPE);
+    bool valid = memcmp(header->magic, CSTRING_ARRAY_FILE_MAGIC, sizeof(CSTRING_ARRAY_FILE_MAGIC)) == 0
+        && header->version == CSTRING_ARRAY_FILE_VERSION
+        && header->byte_order_mark == CSTRING_ARRAY_FILE_BYTE_ORDER_MARK
+        && header->offset_size == offset_size
+        && header->offsets_pos == CSTRING_ARRAY_FILE_ALIGNMENT
+        && header->str_pos % CSTRING_ARRAY_FILE_ALIGNMENT == 0
+        && header->num_strings < (file_size - header->offsets_pos) / offset_size
+        && header->offsets_pos + (header->num_strings + 1) * offset_size <= header->str_pos
+        && header->str_pos < file_size
+        && header->str_size < file_size - header->str_pos
+        && file_size == CSTRING_ARRAY_FUNC(file_size)(header)
+        // The end offset doubles as the array's end sentinel
+        && ((const CSTRING_ARRAY_INDEX_TYPE *)(map + header->offsets_pos))[header->num_strings] == header->str_size;
+
+    if (valid) {
+        const CSTRING_ARRAY_INDEX_TYPE *offsets = (const CSTRING_ARRAY_INDEX_TYPE *)(map + header->offsets_pos);
+        size_t num_strings = (size_t)header->num_strings;
+        // Increasing offsets below the end, which is str_size, keep each string inside str
+        bool increasing = true;
+        for (size_t i = 0; i < num_strings; i++) {
+            increasing &= offsets[i] < offsets[i + 1];
+        }
+        valid = increasing && (num_strings == 0 || map[header->str_pos + header->str_size - 1] == '\0');
+    }
+
+    if (valid && verify_checksum) {
+        const char *offsets = map + header->offsets_pos;
+        size_t offsets_size = (size_t)header->num_strings * offset_size;
+        uint64_t checksum = cstring_array_hash(offsets, offsets_size, 0);
+        checksum = cstring_array_hash(offsets + offsets_size, offset_size, checksum);
+        checksum = cstring_array_hash(map + header->str_pos, header->str_size, checksum);
+        valid = checksum == header->checksum;
+    }
+
+    CSTRING_ARRAY_NAME *array = valid ? calloc(1, sizeof(CSTRING_ARRAY_NAME)) : NULL;
+    if (array != NULL) {
+        array->indices = calloc(1, sizeof(INDEX_ARRAY_NAME));
+        array->str = calloc(1, sizeof(CHAR_ARRAY_NAME));
+    }
+    if (array == NULL || array->indices == NULL || array->str == NULL) {
+        if (array != NULL) {
+            free(array->indices);
+            free(array->str);
+            free(array);
+        }
+        munmap(map, file_size);
+        return NULL;
+    }
+
+    array->indices->a = (CSTRING_ARRAY_INDEX_TYPE *)(map + header->offsets_pos);
+    array->indices->n = (size_t)header->num_strings;
+    array->indices->m = (size_t)header->num_strings;
+    array->str->a = map + header->str_pos;
+    array->str->n = (size_t)header->str_size;
+    array->str->m = (size_t)header->str_size;
+
+    return array;
+}
+
+static inline CSTRING_ARRAY_NAME *CSTRING_ARRAY_FUNC(mmap_open)(const char *path) {
+    return CSTRING_ARRAY_FUNC(mmap_open_options)(path, false);
+}
+
+static void CSTRING_ARRAY_FUNC(mmap_close)(CSTRING_ARRAY_NAME *self) {
+    if (self == NULL) return;
+    // The offsets section always starts right after the header, at the start of the mapping
+    char *map = (char *)self->indices->a - CSTRING_ARRAY_FILE_ALIGNMENT;
+    munmap(map, CSTRING_ARRAY_FUNC(file_size)((const cstring_array_file_header *)map));
+    cstring_array_tombstones_destroy(self->removed);
+    free(self->indices);
+    free(self->str);
+    free(self);
+}
+
+#endif
+
+static cstring_array_sort_entry *CSTRING_ARRAY_FUNC(sorted_entries)(CSTRING_ARRAY_NAME *self) {
+    size_t n = self->indices->n;
+    cstring_array_sort_entry *entries = malloc((n > 0 ? n : 1) * sizeof(cstring_array_sort_entry));
+    if (entries == NULL) return NULL;
+
+    const char *base = self->str->a;
+    for (size_t i = 0; i < n; i++) {
+        entries[i].offset = self->indices->a[i];
+        entries[i].id = i;
+        entries[i].key = cstring_array_sort_key(base + entries[i].offset);
+    }
+    cstring_array_sort_entries(entries, n, base, 0);
+    return entries;
+}
+
+/*
+Writes the ids of the live strings to ids in strcmp order and returns how many there
+are, leaving the array untouched. This is the offsets-only sort: it needs the sort
+entries and nothing else, so it suits arrays too large for sort's copy of the pool.
+Look the strings up with get_string(self, ids[i]). ids must have room for
+num_strings ids. Returns SIZE_MAX on allocation failure.
+*/
+static size_t CSTRING_ARRAY_FUNC(sort_ids)(CSTRING_ARRAY_NAME *self, size_t *ids) {
+    if (self == NULL || ids == NULL) return SIZE_MAX;
+    cstring_array_sort_entry *entries = CSTRING_ARRAY_FUNC(sorted_entries)(self);
+    if (entries == NULL) return SIZE_MAX;
+    size_t n = 0;
+    for (size_t i = 0; i < self->indices->n; i++) {
+        if (!CSTRING_ARRAY_FUNC(is_removed)(self, entries[i].id)) {
+            ids[n++] = entries[i].id;
+        }
+    }
+    free(entries);
+    return n;
+}
+
+/*
+Sorts the strings in strcmp order. Lengths come from adjacent offsets (see
+update_end), so reordering the offsets alone would break them: str is rewritten in
+sorted order too. That's the compact-for-locality step, done every time, and costs a
+temporary copy of the pool and one more pass over it on top of the sort itself.
+Neighbouring strings end up neighbours in memory. Removed strings are compacted away
+first. Where the pool is too large to copy, sort_ids gives the order without moving
+anything.
+*/
+static bool CSTRING_ARRAY_FUNC(sort)(CSTRING_ARRAY_NAME *self) {
+    if (self == NULL) return false;
+    CSTRING_ARRAY_FUNC(compact)(self);
+    size_t n = self->indices->n;
+    const CSTRING_ARRAY_INDEX_TYPE *offsets = self->indices->a;
+
+    // The sorted strings take exactly the room of the originals, so str is reused in place
+    char *sorted = malloc(offsets[n] > 0 ? offsets[n] : 1);
+    if (sorted == NULL) return false;
+    cstring_array_sort_entry *entries = CSTRING_ARRAY_FUNC(sorted_entries)(self);
+    if (entries == NULL) {
+        free(sorted);
+        return false;
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t id = entries[i].id;
+        const char *s = self->str->a + entries[i].offset;
+        size_t len = offsets[id + 1] - offsets[id] - 1;
+        memcpy(sorted + pos, s, len);
+        sorted[pos + len] = '\0';
+        // The old offsets are still needed for lengths, so the new ones go in the spent keys
+        entries[i].key = pos;
+        pos += len + 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        self->indices->a[i] = (CSTRING_ARRAY_INDEX_TYPE)entries[i].key;
+    }
+    free(entries);
+
+    memcpy(self->str->a, sorted, pos);
+    self->str->n = pos;
+    self->indices->a[n] = (CSTRING_ARRAY_INDEX_TYPE)pos;
+    free(sorted);
+    return true;
+}
+
+// First index whose string is >= key[0..len), or num_strings if there is none
+static size_t CSTRING_ARRAY_FUNC(lower_bound)(CSTRING_ARRAY_NAME *self, const char *key, size_t len) {
+    size_t lo = 0, hi = self->indices->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cstring_array_compare_key(self->str->a + self->indices->a[mid], key, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Index of key in a sorted array, or -1
+static int64_t CSTRING_ARRAY_FUNC(bsearch)(CSTRING_ARRAY_NAME *self, const char *key) {
+    size_t len = strlen(key);
+    size_t i = CSTRING_ARRAY_FUNC(lower_bound)(self, key, len);
+    if (i < self->indices->n && cstring_array_compare_key(self->str->a + self->indices->a[i], key, len) == 0 && !CSTRING_ARRAY_FUNC(is_removed)(self, i)) {
+        return (int64_t)i;
+    }
+    return -1;
+}
+
+// Range [*start, *end) of strings in a sorted array that begin with prefix[0..len)
+static void CSTRING_ARRAY_FUNC(prefix_range)(CSTRING_ARRAY_NAME *self, const char *prefix, size_t len, size_t *start, size_t *end) {
+    size_t lo = CSTRING_ARRAY_FUNC(lower_bound)(self, prefix, len);
+    size_t hi = self->indices->n;
+    *start = lo;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cstring_array_compare_prefix(self->str->a + self->indices->a[mid], prefix, len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *end = lo;
+}
+
+/*
+A view borrows a run of strings from an array without copying or allocating: a pointer
+to its offsets, a count and the pool they point into. Views are passed by value and
+stay valid until the array is modified or destroyed. Lengths come from adjacent offsets,
+including the end sentinel after the last one, so no accessor calls strlen.
+*/
+typedef struct {
+    // n + 1 offsets, the last being the end of the view's last string
+    const CSTRING_ARRAY_INDEX_TYPE *offsets;
+    size_t n;
+    char *base;
+} CSTRING_ARRAY_TYPE(view);
+
+static inline CSTRING_ARRAY_TYPE(view) CSTRING_ARRAY_FUNC(view_range)(CSTRING_ARRAY_NAME *self, size_t start, size_t end) {
+    size_t n = self->indices->n;
+    if (end > n) end = n;
+    if (start > end) start = end;
+    CSTRING_ARRAY_TYPE(view) view = {
+        .offsets = self->indices->a + start,
+        .n = end - start,
+        .base = self->str->a
+    };
+    return view;
+}
+
+static inline CSTRING_ARRAY_TYPE(view) CSTRING_ARRAY_FUNC(as_view)(CSTRING_ARRAY_NAME *self) {
+    return CSTRING_ARRAY_FUNC(view_range)(self, 0, self->indices->n);
+}
+
+static inline CSTRING_ARRAY_TYPE(view) CSTRING_ARRAY_FUNC(view_subrange)(CSTRING_ARRAY_TYPE(view) view, size_t start, size_t end) {
+    if (end > view.n) end = view.n;
+    if (start > end) start = end;
+    CSTRING_ARRAY_TYPE(view) sub = {
+        .offsets = view.offsets + start,
+        .n = end - start,
+        .base = view.base
+    };
+    return sub;
+}
+
+static inline size_t CSTRING_ARRAY_FUNC(view_num_strings)(CSTRING_ARRAY_TYPE(view) view) {
+    return view.n;
+}
+
+static inline char *CSTRING_ARRAY_FUNC(view_get_string)(CSTRING_ARRAY_TYPE(view) view, size_t i, size_t *len) {
+    if (i >= view.n) return NULL;
+    size_t start = view.offsets[i];
+    if (len != NULL) *len = (size_t)view.offsets[i + 1] - start - 1;
+    return view.base + start;
+}
+
+/*
+Iterates over a view:
+
+    size_t i = 0;
+    char *str;
+    size_t len;
+    while (cstring_array_view_next(view, &i, &str, &len)) { ... }
+*/
+static inline bool CSTRING_ARRAY_FUNC(view_next)(CSTRING_ARRAY_TYPE(view) view, size_t *i, char **str, size_t *len) {
+    char *s = CSTRING_ARRAY_FUNC(view_get_string)(view, *i, len);
+    if (s == NULL) return false;
+    *str = s;
+    (*i)++;
+    return true;
+}
+
+// Pointers into the view's pool; only the returned array is the caller's to free
+static char **CSTRING_ARRAY_FUNC(view_to_strings_borrowed)(CSTRING_ARRAY_TYPE(view) view) {
+    char **strings = malloc((view.n > 0 ? view.n : 1) * sizeof(char *));
+    if (strings == NULL) return NULL;
+    for (size_t i = 0; i < view.n; i++) {
+        strings[i] = view.base + view.offsets[i];
+    }
+    return strings;
+}
+
+// Like to_strings, but the strings point into self, which is left intact
+static inline char **CSTRING_ARRAY_FUNC(to_strings_borrowed)(CSTRING_ARRAY_NAME *self) {
+    return CSTRING_ARRAY_FUNC(view_to_strings_borrowed)(CSTRING_ARRAY_FUNC(as_view)(self));
+}
+
+static char **CSTRING_ARRAY_FUNC(to_strings)(CSTRING_ARRAY_NAME *self) {
+    // self is destroyed anyway, so removed strings are dropped the cheap way
+    CSTRING_ARRAY_FUNC(compact)(self);
+    char **strings = malloc(self->indices->n * sizeof(char *));
+
+    for (size_t i = 0; i < CSTRING_ARRAY_FUNC(num_strings)(self); i++) {
+        size_t len;
+        char *str = CSTRING_ARRAY_FUNC(get_string_len)(self, i, &len);
+        strings[i] = malloc(len + 1);
+        if (strings[i] != NULL) {
+            memcpy(strings[i], str, len + 1);
+        }
     }
 
     CSTRING_ARRAY_FUNC(destroy)(self);
@@ -313,8 +3367,12 @@ static char **CSTRING_ARRAY_FUNC(to_strings)(CSTRING_ARRAY_NAME *self) {
 #undef CONCAT_
 #undef CONCAT
 #undef CSTRING_ARRAY_FUNC
+#undef CSTRING_ARRAY_TYPE
 #undef CHAR_ARRAY_FUNC
 #undef CSTRING_ARRAY_NAME
 #undef CHAR_ARRAY_NAME
 #undef INDEX_ARRAY_NAME
-#undef INDEX_ARRAY_FUNC
\ No newline at end of file
+#undef INDEX_ARRAY_FUNC
+#undef CSTRING_ARRAY_INDEX_TYPE
+#undef CSTRING_ARRAY_INDEX_MAX
+#undef CSTRING_ARRAY_ALIGNMENT
\ No newline at end of file
@@ -0,0 +1,265 @@
+/*
+cstring_array_concurrent lets many threads append strings to one shared result without a
+lock. Each add reserves a slot and a byte range with one atomic fetch-add apiece, then
+copies the string in; nothing is ever moved, because strings go into fixed-size segments
+that are allocated on first use and installed with a compare-and-swap. Once every writer
+is done, finalize copies the strings into a regular contiguous cstring_array, where the
+id returned by add_string is the string's index.
+
+The byte space is one virtual range split into segments, so a string may straddle two or
+more of them. Slots hold each string's byte offset and length. The tables of segment
+pointers are two-level and also filled in on first use, so an empty builder is a few KiB.
+
+Two fetch-adds per string on shared counters will contend at high thread counts. A
+cstring_array_concurrent_writer, one per thread, buffers strings locally and reserves
+slots and bytes for a whole batch at once, so the shared counters are touched once per
+batch instead of once per string.
+
+Uses the GCC/Clang __atomic builtins.
+*/
+
+#ifndef CSTRING_ARRAY_CONCURRENT_H
+#define CSTRING_ARRAY_CONCURRENT_H
+
+#include "cstring_array.h"
+
+#define CSTRING_ARRAY_CONCURRENT_TABLE_SIZE (1 << 8)
+#define CSTRING_ARRAY_CONCURRENT_MAX_SEGMENTS (CSTRING_ARRAY_CONCURRENT_TABLE_SIZE * CSTRING_ARRAY_CONCURRENT_TABLE_SIZE)
+#define CSTRING_ARRAY_CONCURRENT_DEFAULT_SEGMENT_SIZE (1 << 20)
+#define CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT (1 << 16)
+#define CSTRING_ARRAY_CONCURRENT_WRITER_BATCH (1 << 16)
+#define CSTRING_ARRAY_CONCURRENT_FAILED UINT64_MAX
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;
+} cstring_array_concurrent_slot;
+
+typedef struct {
+    size_t segment_size;
+    uint64_t num_slots;
+    uint64_t num_bytes;
+    // Set when an add couldn't store its string, which makes finalize fail
+    bool failed;
+    // Segment i is at segments[i / TABLE_SIZE][i % TABLE_SIZE], likewise for slots
+    void **segments[CSTRING_ARRAY_CONCURRENT_TABLE_SIZE];
+    void **slots[CSTRING_ARRAY_CONCURRENT_TABLE_SIZE];
+} cstring_array_concurrent;
+
+// segment_size is the size of each byte segment, 0 for the default
+static cstring_array_concurrent *cstring_array_concurrent_new_size(size_t segment_size) {
+    cstring_array_concurrent *self = calloc(1, sizeof(cstring_array_concurrent));
+    if (self == NULL) return NULL;
+    self->segment_size = segment_size > 0 ? segment_size : CSTRING_ARRAY_CONCURRENT_DEFAULT_SEGMENT_SIZE;
+    return self;
+}
+
+static inline cstring_array_concurrent *cstring_array_concurrent_new(void) {
+    return cstring_array_concurrent_new_size(0);
+}
+
+static void cstring_array_concurrent_table_destroy(void ***table) {
+    for (size_t i = 0; i < CSTRING_ARRAY_CONCURRENT_TABLE_SIZE; i++) {
+        if (table[i] == NULL) continue;
+        for (size_t j = 0; j < CSTRING_ARRAY_CONCURRENT_TABLE_SIZE; j++) {
+            free(table[i][j]);
+        }
+        free(table[i]);
+    }
+}
+
+static void cstring_array_concurrent_destroy(cstring_array_concurrent *self) {
+    if (self == NULL) return;
+    cstring_array_concurrent_table_destroy(self->segments);
+    cstring_array_concurrent_table_destroy(self->slots);
+    free(self);
+}
+
+// Returns the segment at *slot, allocating it (zeroed if asked) if no other thread has yet
+static void *cstring_array_concurrent_segment(void **slot, size_t size, bool zeroed) {
+    void *segment = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (segment != NULL) return segment;
+
+    void *fresh = zeroed ? calloc(1, size) : malloc(size);
+    if (fresh == NULL) return NULL;
+    if (__atomic_compare_exchange_n(slot, &segment, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return fresh;
+    }
+    // Another thread won the race, segment now holds its allocation
+    free(fresh);
+    return segment;
+}
+
+// Segment index of table, allocating it and the block of the table holding it on first use
+static void *cstring_array_concurrent_table_segment(void ***table, uint64_t index, size_t size) {
+    if (index >= CSTRING_ARRAY_CONCURRENT_MAX_SEGMENTS) return NULL;
+    void **block = cstring_array_concurrent_segment((void **)&table[index / CSTRING_ARRAY_CONCURRENT_TABLE_SIZE], CSTRING_ARRAY_CONCURRENT_TABLE_SIZE * sizeof(void *), true);
+    if (block == NULL) return NULL;
+    return cstring_array_concurrent_segment(&block[index % CSTRING_ARRAY_CONCURRENT_TABLE_SIZE], size, false);
+}
+
+// Segment index of table once every writer is done, when it's known to exist
+static inline void *cstring_array_concurrent_table_get(void ***table, uint64_t index) {
+    return table[index / CSTRING_ARRAY_CONCURRENT_TABLE_SIZE][index % CSTRING_ARRAY_CONCURRENT_TABLE_SIZE];
+}
+
+static bool cstring_array_concurrent_write(cstring_array_concurrent *self, uint64_t offset, const char *data, size_t len) {
+    size_t segment_size = self->segment_size;
+    while (len > 0) {
+        char *segment = cstring_array_concurrent_table_segment(self->segments, offset / segment_size, segment_size);
+        if (segment == NULL) return false;
+        size_t start = (size_t)(offset % segment_size);
+        size_t n = segment_size - start < len ? segment_size - start : len;
+        memcpy(segment + start, data, n);
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool cstring_array_concurrent_set_slot(cstring_array_concurrent *self, uint64_t id, uint64_t offset, uint64_t len) {
+    cstring_array_concurrent_slot *slots = cstring_array_concurrent_table_segment(self->slots, id / CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT, CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT * sizeof(cstring_array_concurrent_slot));
+    if (slots == NULL) return false;
+    slots[id % CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT].offset = offset;
+    slots[id % CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT].len = len;
+    return true;
+}
+
+static inline void cstring_array_concurrent_fail(cstring_array_concurrent *self) {
+    __atomic_store_n(&self->failed, true, __ATOMIC_RELAXED);
+}
+
+/*
+Adds the len bytes of str from any thread. Returns the string's index in the finalized
+array, or CSTRING_ARRAY_CONCURRENT_FAILED if it couldn't be stored, in which case
+finalize will fail too.
+*/
+static uint64_t cstring_array_concurrent_add_string_len(cstring_array_concurrent *self, const char *str, size_t len) {
+    uint64_t id = __atomic_fetch_add(&self->num_slots, 1, __ATOMIC_RELAXED);
+    uint64_t offset = __atomic_fetch_add(&self->num_bytes, (uint64_t)len + 1, __ATOMIC_RELAXED);
+    if (!cstring_array_concurrent_write(self, offset, str, len) || !cstring_array_concurrent_set_slot(self, id, offset, len)) {
+        cstring_array_concurrent_fail(self);
+        return CSTRING_ARRAY_CONCURRENT_FAILED;
+    }
+    return id;
+}
+
+static inline uint64_t cstring_array_concurrent_add_string(cstring_array_concurrent *self, const char *str) {
+    return cstring_array_concurrent_add_string_len(self, str, strlen(str));
+}
+
+// Number of strings added so far
+static inline uint64_t cstring_array_concurrent_num_strings(cstring_array_concurrent *self) {
+    return __atomic_load_n(&self->num_slots, __ATOMIC_ACQUIRE);
+}
+
+// Copies len bytes at offset out of the segments, the reverse of cstring_array_concurrent_write
+static void cstring_array_concurrent_read(cstring_array_concurrent *self, uint64_t offset, char *out, size_t len) {
+    size_t segment_size = self->segment_size;
+    while (len > 0) {
+        const char *segment = cstring_array_concurrent_table_get(self->segments, offset / segment_size);
+        size_t start = (size_t)(offset % segment_size);
+        size_t n = segment_size - start < len ? segment_size - start : len;
+        memcpy(out, segment + start, n);
+        out += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+/*
+Builds a contiguous cstring_array with the strings in id order. Every writer must have
+finished (joined, with its writer flushed) before this is called. Returns NULL if an add
+failed, the strings don't fit cstring_array's 32-bit offsets, or on allocation failure.
+self is left as is and can be destroyed afterwards.
+*/
+static cstring_array *cstring_array_concurrent_finalize(cstring_array_concurrent *self) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (self->failed) return NULL;
+    uint64_t n = self->num_slots;
+    uint64_t total = self->num_bytes;
+    if (total >= UINT32_MAX) return NULL;
+
+    cstring_array *array = cstring_array_new_size((size_t)total + 1);
+    if (array == NULL) return NULL;
+    if (cstring_array_capacity(array) < total + 1) {
+        cstring_array_destroy(array);
+        return NULL;
+    }
+
+    for (uint64_t id = 0; id < n; id++) {
+        const cstring_array_concurrent_slot *slots = cstring_array_concurrent_table_get(self->slots, id / CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT);
+        const cstring_array_concurrent_slot *slot = &slots[id % CSTRING_ARRAY_CONCURRENT_SLOTS_PER_SEGMENT];
+        if (cstring_array_start_token(array) == UINT32_MAX) {
+            cstring_array_destroy(array);
+            return NULL;
+        }
+        // str was reserved up front, so this writes straight into it
+        cstring_array_concurrent_read(self, slot->offset, array->str->a + array->str->n, (size_t)slot->len);
+        array->str->n += (size_t)slot->len;
+        cstring_array_terminate(array);
+    }
+    return array;
+}
+
+/*
+A per-thread writer that buffers strings in a local cstring_array and publishes them in
+batches of about CSTRING_ARRAY_CONCURRENT_WRITER_BATCH bytes: one fetch-add each for the
+batch's slots and bytes, one copy of its bytes, then its slots. Strings from one writer
+keep their relative order. Call writer_destroy (which flushes) before finalize.
+*/
+typedef struct {
+    cstring_array_concurrent *shared;
+    cstring_array *local;
+} cstring_array_concurrent_writer;
+
+static inline bool cstring_array_concurrent_writer_init(cstring_array_concurrent_writer *self, cstring_array_concurrent *shared) {
+    self->shared = shared;
+    self->local = cstring_array_new_size(CSTRING_ARRAY_CONCURRENT_WRITER_BATCH);
+    return self->local != NULL;
+}
+
+static bool cstring_array_concurrent_writer_flush(cstring_array_concurrent_writer *self) {
+    cstring_array *local = self->local;
+    size_t n = cstring_array_num_strings(local);
+    if (n == 0) return true;
+
+    cstring_array_concurrent *shared = self->shared;
+    size_t num_bytes = cstring_array_used(local);
+    uint64_t first_id = __atomic_fetch_add(&shared->num_slots, (uint64_t)n, __ATOMIC_RELAXED);
+    uint64_t base = __atomic_fetch_add(&shared->num_bytes, (uint64_t)num_bytes, __ATOMIC_RELAXED);
+
+    bool ok = cstring_array_concurrent_write(shared, base, local->str->a, num_bytes);
+    for (size_t i = 0; ok && i < n; i++) {
+        size_t len;
+        cstring_array_get_string_len(local, i, &len);
+        ok = cstring_array_concurrent_set_slot(shared, first_id + i, base + local->indices->a[i], len);
+    }
+    if (!ok) {
+        cstring_array_concurrent_fail(shared);
+    }
+    cstring_array_clear(local);
+    return ok;
+}
+
+static inline bool cstring_array_concurrent_writer_add_string_len(cstring_array_concurrent_writer *self, char *str, size_t len) {
+    if (cstring_array_add_string_len(self->local, str, len) == UINT32_MAX) return false;
+    if (cstring_array_used(self->local) >= CSTRING_ARRAY_CONCURRENT_WRITER_BATCH) {
+        return cstring_array_concurrent_writer_flush(self);
+    }
+    return true;
+}
+
+static inline bool cstring_array_concurrent_writer_add_string(cstring_array_concurrent_writer *self, char *str) {
+    return cstring_array_concurrent_writer_add_string_len(self, str, strlen(str));
+}
+
+static bool cstring_array_concurrent_writer_destroy(cstring_array_concurrent_writer *self) {
+    bool ok = cstring_array_concurrent_writer_flush(self);
+    cstring_array_destroy(self->local);
+    self->local = NULL;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,304 @@
+/*
+cstring_array_frozen is a read-only, prefix-compressed copy of a sorted cstring_array,
+for large sorted vocabularies and URL lists where neighbouring strings share long
+prefixes.
+
+Strings are front-coded in blocks of block_size. The first string of each block, its
+anchor, is stored in full; every other string stores only the length of the prefix it
+shares with the previous string and the remaining suffix:
+
+anchor:  varint(len) bytes
+others:  varint(shared) varint(suffix_len) suffix
+
+Lengths are LEB128 varints, so short strings cost a byte or two of overhead. Decoding
+string i walks at most block_size - 1 entries from its block's anchor, and lookup
+binary searches the anchors before scanning a single block. Larger blocks compress
+better and decode more slowly.
+*/
+
+#ifndef CSTRING_ARRAY_FROZEN_H
+#define CSTRING_ARRAY_FROZEN_H
+
+#include "cstring_array.h"
+
+#define CSTRING_ARRAY_FROZEN_DEFAULT_BLOCK_SIZE 16
+
+typedef struct {
+    size_t num_strings;
+    size_t block_size;
+    size_t num_blocks;
+    // Start of each block in data
+    uint64_t *blocks;
+    unsigned char *data;
+    size_t data_size;
+    // Sum of the string lengths including terminators, to size decode-all in one go
+    size_t str_size;
+} cstring_array_frozen;
+
+static inline size_t cstring_array_frozen_varint_size(size_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline unsigned char *cstring_array_frozen_put_varint(unsigned char *p, size_t value) {
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+static inline const unsigned char *cstring_array_frozen_get_varint(const unsigned char *p, size_t *value) {
+    size_t result = 0;
+    unsigned shift = 0;
+    while (*p & 0x80) {
+        result |= (size_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value = result | ((size_t)*p++ << shift);
+    return p;
+}
+
+static inline size_t cstring_array_frozen_common_prefix(const char *a, size_t a_len, const char *b, size_t b_len) {
+    size_t len = a_len < b_len ? a_len : b_len;
+    size_t i = 0;
+    while (i < len && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int cstring_array_frozen_compare(const char *str, size_t len, const char *key, size_t key_len) {
+    size_t min_len = len < key_len ? len : key_len;
+    int cmp = memcmp(str, key, min_len);
+    if (cmp != 0) return cmp;
+    return len < key_len ? -1 : (len > key_len ? 1 : 0);
+}
+
+/*
+Builds a frozen copy of array, which must be sorted in byte order (as cstring_array_sort
+leaves it). Returns NULL if it isn't sorted or on allocation failure. block_size 0 means
+CSTRING_ARRAY_FROZEN_DEFAULT_BLOCK_SIZE. Removed strings are left out. array is left
+untouched and can be destroyed.
+*/
+static cstring_array_frozen *cstring_array_frozen_new(cstring_array *array, size_t block_size) {
+    if (array == NULL) return NULL;
+    if (block_size == 0) block_size = CSTRING_ARRAY_FROZEN_DEFAULT_BLOCK_SIZE;
+    size_t n = cstring_array_num_strings(array);
+
+    // First pass sizes the encoding exactly and checks the order
+    size_t num_strings = 0;
+    size_t data_size = 0;
+    size_t str_size = 0;
+    const char *prev = NULL;
+    size_t prev_len = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len;
+        const char *str = cstring_array_get_string_len(array, i, &len);
+        if (str == NULL) continue;
+        if (prev != NULL && cstring_array_frozen_compare(prev, prev_len, str, len) > 0) return NULL;
+        if (num_strings++ % block_size == 0) {
+            data_size += cstring_array_frozen_varint_size(len) + len;
+        } else {
+            size_t shared = cstring_array_frozen_common_prefix(prev, prev_len, str, len);
+            data_size += cstring_array_frozen_varint_size(shared) + cstring_array_frozen_varint_size(len - shared) + len - shared;
+        }
+        str_size += len + 1;
+        prev = str;
+        prev_len = len;
+    }
+
+    cstring_array_frozen *self = malloc(sizeof(cstring_array_frozen));
+    if (self == NULL) return NULL;
+    self->num_strings = num_strings;
+    self->block_size = block_size;
+    self->num_blocks = (num_strings + block_size - 1) / block_size;
+    self->data_size = data_size;
+    self->str_size = str_size;
+    self->blocks = malloc((self->num_blocks + 1) * sizeof(uint64_t));
+    self->data = malloc(data_size > 0 ? data_size : 1);
+    if (self->blocks == NULL || self->data == NULL) {
+        free(self->blocks);
+        free(self->data);
+        free(self);
+        return NULL;
+    }
+
+    unsigned char *p = self->data;
+    prev = NULL;
+    prev_len = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len;
+        const char *str = cstring_array_get_string_len(array, i, &len);
+        if (str == NULL) continue;
+        if (j++ % block_size == 0) {
+            self->blocks[(j - 1) / block_size] = (uint64_t)(p - self->data);
+            p = cstring_array_frozen_put_varint(p, len);
+            memcpy(p, str, len);
+            p += len;
+        } else {
+            size_t shared = cstring_array_frozen_common_prefix(prev, prev_len, str, len);
+            p = cstring_array_frozen_put_varint(p, shared);
+            p = cstring_array_frozen_put_varint(p, len - shared);
+            memcpy(p, str + shared, len - shared);
+            p += len - shared;
+        }
+        prev = str;
+        prev_len = len;
+    }
+    self->blocks[self->num_blocks] = (uint64_t)data_size;
+    return self;
+}
+
+static void cstring_array_frozen_destroy(cstring_array_frozen *self) {
+    if (self == NULL) return;
+    free(self->blocks);
+    free(self->data);
+    free(self);
+}
+
+static inline size_t cstring_array_frozen_num_strings(cstring_array_frozen *self) {
+    return self->num_strings;
+}
+
+// Bytes used by the encoded strings and the block index
+static inline size_t cstring_array_frozen_memory_size(cstring_array_frozen *self) {
+    return sizeof(cstring_array_frozen) + self->data_size + (self->num_blocks + 1) * sizeof(uint64_t);
+}
+
+/*
+Decodes string i into buf, truncating it to size - 1 bytes, and always NUL-terminates
+when size > 0. Returns the full length of the string, like snprintf, so a result >= size
+means buf was too small, or -1 if i is out of range. buf may be NULL when size is 0.
+*/
+static int64_t cstring_array_frozen_get_string(cstring_array_frozen *self, size_t i, char *buf, size_t size) {
+    if (i >= self->num_strings) return -1;
+    size_t cap = size > 0 ? size - 1 : 0;
+    const unsigned char *p = self->data + self->blocks[i / self->block_size];
+
+    size_t len;
+    p = cstring_array_frozen_get_varint(p, &len);
+    // buf may be NULL when size is 0, to query the length
+    if (cap > 0) memcpy(buf, p, len < cap ? len : cap);
+    p += len;
+
+    // Shared prefixes past cap are never needed, since nothing past cap is written
+    for (size_t j = i - i % self->block_size; j < i; j++) {
+        size_t shared, suffix_len;
+        p = cstring_array_frozen_get_varint(p, &shared);
+        p = cstring_array_frozen_get_varint(p, &suffix_len);
+        if (shared < cap) {
+            size_t copy = suffix_len < cap - shared ? suffix_len : cap - shared;
+            memcpy(buf + shared, p, copy);
+        }
+        p += suffix_len;
+        len = shared + suffix_len;
+    }
+
+    if (size > 0) {
+        buf[len < cap ? len : cap] = '\0';
+    }
+    return (int64_t)len;
+}
+
+/*
+Index of a string equal to the len bytes of key, or -1. Binary searches the block
+anchors, then scans one block, tracking how much of key the current string matches so
+that each entry is decided from its shared-prefix length and at most its suffix.
+*/
+static int64_t cstring_array_frozen_lookup_len(cstring_array_frozen *self, const char *key, size_t key_len) {
+    if (self->num_blocks == 0) return -1;
+
+    // Last block whose anchor is <= key
+    size_t lo = 0, hi = self->num_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t len;
+        const unsigned char *p = cstring_array_frozen_get_varint(self->data + self->blocks[mid], &len);
+        if (cstring_array_frozen_compare((const char *)p, len, key, key_len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) return -1;
+    size_t block = lo - 1;
+
+    size_t len;
+    const unsigned char *p = cstring_array_frozen_get_varint(self->data + self->blocks[block], &len);
+    size_t matched = cstring_array_frozen_common_prefix((const char *)p, len, key, key_len);
+    size_t i = block * self->block_size;
+    if (matched == len && matched == key_len) return (int64_t)i;
+    p += len;
+
+    // From here on the current string is < key and shares matched bytes with it
+    const unsigned char *end = self->data + self->blocks[block + 1];
+    while (p < end) {
+        size_t shared, suffix_len;
+        p = cstring_array_frozen_get_varint(p, &shared);
+        p = cstring_array_frozen_get_varint(p, &suffix_len);
+        const char *suffix = (const char *)p;
+        p += suffix_len;
+        i++;
+
+        // Diverges from the current string before key does, so it sorts after key
+        if (shared < matched) return -1;
+        // Keeps the byte where the current string was already less than key
+        if (shared > matched) continue;
+
+        size_t common = cstring_array_frozen_common_prefix(suffix, suffix_len, key + matched, key_len - matched);
+        matched += common;
+        if (common == suffix_len) {
+            if (matched == key_len) return (int64_t)i;
+            continue;
+        }
+        if (matched == key_len || (unsigned char)suffix[common] > (unsigned char)key[matched]) return -1;
+    }
+    return -1;
+}
+
+static inline int64_t cstring_array_frozen_lookup(cstring_array_frozen *self, const char *key) {
+    return cstring_array_frozen_lookup_len(self, key, strlen(key));
+}
+
+// Decodes every string back into a new, regular cstring_array
+static cstring_array *cstring_array_frozen_to_cstring_array(cstring_array_frozen *self) {
+    cstring_array *array = cstring_array_new_size(self->str_size);
+    if (array == NULL) return NULL;
+    if (cstring_array_capacity(array) < self->str_size) {
+        cstring_array_destroy(array);
+        return NULL;
+    }
+
+    // With str reserved up front, the previous string stays put while the next is built from it
+    const unsigned char *p = self->data;
+    size_t prev = 0;
+    for (size_t i = 0; i < self->num_strings; i++) {
+        size_t start = cstring_array_used(array);
+        cstring_array_start_token(array);
+        if (i % self->block_size == 0) {
+            size_t len;
+            p = cstring_array_frozen_get_varint(p, &len);
+            cstring_array_append_string_len(array, (char *)p, len);
+            p += len;
+        } else {
+            size_t shared, suffix_len;
+            p = cstring_array_frozen_get_varint(p, &shared);
+            p = cstring_array_frozen_get_varint(p, &suffix_len);
+            cstring_array_append_string_len(array, array->str->a + prev, shared);
+            cstring_array_append_string_len(array, (char *)p, suffix_len);
+            p += suffix_len;
+        }
+        cstring_array_terminate(array);
+        prev = start;
+    }
+    return array;
+}
+
+#endif
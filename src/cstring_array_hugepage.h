@@ -0,0 +1,197 @@
+/*
+cstring_array_hugepage_allocator backs large arrays with anonymous memory mappings
+instead of malloc, for multi-GB pools where random get_string access is dominated by
+TLB misses:
+
+- allocations of at least threshold bytes are mapped and advised MADV_HUGEPAGE, or
+  mapped with MAP_HUGETLB when use_hugetlb is set and huge pages are reserved
+- growth uses mremap, which moves the pages instead of copying them
+- populate faults every page in at allocation time, and the new tail of a mapping
+  when it grows. Under the kernel's first-touch policy that places the pool on the
+  NUMA node of the allocating thread, so allocate from a thread pinned to the node
+  that will read the array
+
+Smaller allocations, including the array structs, come from malloc. Mapped sizes are
+rounded up to whole huge pages (whole pages below the huge page size), so the rounding
+never costs more than a huge page per buffer.
+
+mremap, MAP_ANONYMOUS and the madvise flags are Linux/BSD extensions that glibc only
+declares with _GNU_SOURCE (or _DEFAULT_SOURCE) defined before the first system header.
+This header can't define it itself, as by the time it's included that has usually
+happened, so define it on the command line (-D_GNU_SOURCE) or at the top of the file.
+Each extension is used if it's available; without any of them the allocator is plain
+malloc.
+*/
+
+#ifndef CSTRING_ARRAY_HUGEPAGE_H
+#define CSTRING_ARRAY_HUGEPAGE_H
+
+#include "cstring_array_aligned.h"
+
+#if defined(CSTRING_ARRAY_HAVE_MMAP) && (defined(MAP_ANONYMOUS) || defined(MAP_ANON))
+#define CSTRING_ARRAY_HAVE_HUGEPAGES
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#define CSTRING_ARRAY_HUGEPAGE_SIZE ((size_t)2 << 20)
+#define CSTRING_ARRAY_HUGEPAGE_DEFAULT_THRESHOLD CSTRING_ARRAY_HUGEPAGE_SIZE
+
+typedef struct {
+    cstring_array_allocator allocator;
+    // Allocations of at least this many bytes are mapped
+    size_t threshold;
+    // Try MAP_HUGETLB before transparent huge pages; needs pages reserved in vm.nr_hugepages
+    bool use_hugetlb;
+    // Fault pages in when they're mapped rather than on first use
+    bool populate;
+} cstring_array_hugepage_allocator;
+
+// malloc with the original pointer stored just below the aligned block
+static void *cstring_array_hugepage_small_alloc(size_t size, size_t alignment) {
+    if (alignment < sizeof(void *)) alignment = sizeof(void *);
+    char *raw = malloc(size + alignment + sizeof(void *));
+    if (raw == NULL) return NULL;
+    void **ptr = (void **)cstring_array_align_up((uintptr_t)raw + sizeof(void *), alignment);
+    ptr[-1] = raw;
+    return ptr;
+}
+
+static inline void cstring_array_hugepage_small_free(void *ptr) {
+    if (ptr != NULL) free(((void **)ptr)[-1]);
+}
+
+#ifdef CSTRING_ARRAY_HAVE_HUGEPAGES
+
+static inline size_t cstring_array_hugepage_mapped_size(size_t size) {
+    if (size >= CSTRING_ARRAY_HUGEPAGE_SIZE) return cstring_array_align_up(size, CSTRING_ARRAY_HUGEPAGE_SIZE);
+    return cstring_array_align_up(size, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+/*
+Advises ptr[start..end) to use huge pages and, with populate set, faults it in. Faulting
+after the advice gets huge pages straight away, which MAP_POPULATE, faulting before it,
+wouldn't; it's also the only way to populate the range mremap adds when a mapping grows.
+*/
+static void cstring_array_hugepage_prepare(cstring_array_hugepage_allocator *self, char *ptr, size_t start, size_t end) {
+#ifdef MADV_HUGEPAGE
+    madvise(ptr + start, end - start, MADV_HUGEPAGE);
+#endif
+    if (!self->populate) return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr + start, end - start, MADV_POPULATE_WRITE) == 0) return;
+#endif
+    // Older kernels: touch every page, which a fresh anonymous mapping reads back as 0
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = start; i < end; i += page_size) {
+        ((volatile char *)ptr)[i] = 0;
+    }
+}
+
+static void *cstring_array_hugepage_map(cstring_array_hugepage_allocator *self, size_t len) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (self->use_hugetlb && len % CSTRING_ARRAY_HUGEPAGE_SIZE == 0) {
+        int hugetlb_flags = flags | MAP_HUGETLB;
+#ifdef MAP_POPULATE
+        // Already huge pages, so there's nothing to advise before faulting them in
+        if (self->populate) hugetlb_flags |= MAP_POPULATE;
+#endif
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, hugetlb_flags, -1, 0);
+        if (ptr != MAP_FAILED) return ptr;
+    }
+#endif
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED) return NULL;
+    cstring_array_hugepage_prepare(self, ptr, 0, len);
+    return ptr;
+}
+
+#endif
+
+static void *cstring_array_hugepage_realloc(cstring_array_allocator *allocator, void *ptr, size_t old_size, size_t size, size_t alignment) {
+    cstring_array_hugepage_allocator *self = (cstring_array_hugepage_allocator *)allocator;
+    size_t copy = old_size < size ? old_size : size;
+
+#ifdef CSTRING_ARRAY_HAVE_HUGEPAGES
+    bool was_mapped = ptr != NULL && old_size >= self->threshold;
+    if (size >= self->threshold) {
+        size_t len = cstring_array_hugepage_mapped_size(size);
+        if (was_mapped) {
+            size_t old_len = cstring_array_hugepage_mapped_size(old_size);
+            if (len == old_len) return ptr;
+#ifdef MREMAP_MAYMOVE
+            void *moved = mremap(ptr, old_len, len, MREMAP_MAYMOVE);
+            if (moved != MAP_FAILED) {
+                if (len > old_len) cstring_array_hugepage_prepare(self, moved, old_len, len);
+                return moved;
+            }
+#endif
+        }
+        void *new_ptr = cstring_array_hugepage_map(self, len);
+        if (new_ptr == NULL) return NULL;
+        if (ptr != NULL) {
+            memcpy(new_ptr, ptr, copy);
+            if (was_mapped) {
+                munmap(ptr, cstring_array_hugepage_mapped_size(old_size));
+            } else {
+                cstring_array_hugepage_small_free(ptr);
+            }
+        }
+        return new_ptr;
+    }
+#else
+    (void)self;
+#endif
+
+    void *new_ptr = cstring_array_hugepage_small_alloc(size, alignment);
+    if (new_ptr == NULL) return NULL;
+    if (ptr != NULL) {
+        memcpy(new_ptr, ptr, copy);
+#ifdef CSTRING_ARRAY_HAVE_HUGEPAGES
+        if (was_mapped) {
+            munmap(ptr, cstring_array_hugepage_mapped_size(old_size));
+            return new_ptr;
+        }
+#endif
+        cstring_array_hugepage_small_free(ptr);
+    }
+    return new_ptr;
+}
+
+static void cstring_array_hugepage_free(cstring_array_allocator *allocator, void *ptr, size_t size) {
+    cstring_array_hugepage_allocator *self = (cstring_array_hugepage_allocator *)allocator;
+    if (ptr == NULL) return;
+#ifdef CSTRING_ARRAY_HAVE_HUGEPAGES
+    if (size >= self->threshold) {
+        munmap(ptr, cstring_array_hugepage_mapped_size(size));
+        return;
+    }
+#else
+    (void)self;
+    (void)size;
+#endif
+    cstring_array_hugepage_small_free(ptr);
+}
+
+// threshold 0 means CSTRING_ARRAY_HUGEPAGE_DEFAULT_THRESHOLD
+static inline void cstring_array_hugepage_allocator_init(cstring_array_hugepage_allocator *self, size_t threshold) {
+    self->allocator.realloc = cstring_array_hugepage_realloc;
+    self->allocator.free = cstring_array_hugepage_free;
+    self->threshold = threshold > 0 ? threshold : CSTRING_ARRAY_HUGEPAGE_DEFAULT_THRESHOLD;
+    self->use_hugetlb = false;
+    self->populate = false;
+}
+
+/*
+An aligned array whose buffers come from allocator, sized for the given estimates.
+Sizing num_bytes past the threshold up front maps str right away. The allocator must
+outlive the array.
+*/
+static inline cstring_array_aligned *cstring_array_aligned_new_hugepage(cstring_array_hugepage_allocator *allocator, size_t num_strings, size_t num_bytes) {
+    return cstring_array_aligned_new_allocator(&allocator->allocator, num_strings, num_bytes);
+}
+
+#endif
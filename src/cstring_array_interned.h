@@ -0,0 +1,155 @@
+/*
+cstring_array_interned is a deduplicating cstring_array: each distinct string is stored
+once in the usual indices/str layout, and adding a string that's already present returns
+the id it was first given. An open-addressing hash table with linear probing maps strings
+to ids. Slots cache 32 bits of the hash, so probes rarely touch the pool and growing the
+table never rehashes string bytes.
+
+Memory is proportional to the unique strings: the pool, one offset per unique string
+and 8 bytes per table slot at a load factor of at most 3/4.
+*/
+
+#ifndef CSTRING_ARRAY_INTERNED_H
+#define CSTRING_ARRAY_INTERNED_H
+
+#include "cstring_array.h"
+
+#define CSTRING_ARRAY_INTERNED_MIN_SLOTS 16
+#define CSTRING_ARRAY_INTERNED_NOT_FOUND UINT32_MAX
+
+typedef struct {
+    uint32_t hash;
+    // id + 1 of the string in this slot, 0 if the slot is empty
+    uint32_t id;
+} cstring_array_interned_slot;
+
+typedef struct {
+    cstring_array *strings;
+    cstring_array_interned_slot *slots;
+    size_t num_slots;
+} cstring_array_interned;
+
+static cstring_array_interned *cstring_array_interned_new_size(size_t num_strings) {
+    cstring_array_interned *self = malloc(sizeof(cstring_array_interned));
+    if (self == NULL) return NULL;
+
+    size_t num_slots = CSTRING_ARRAY_INTERNED_MIN_SLOTS;
+    while (num_slots / 4 * 3 < num_strings) {
+        num_slots *= 2;
+    }
+
+    self->strings = cstring_array_new();
+    self->slots = calloc(num_slots, sizeof(cstring_array_interned_slot));
+    self->num_slots = num_slots;
+    if (self->strings == NULL || self->slots == NULL) {
+        cstring_array_destroy(self->strings);
+        free(self->slots);
+        free(self);
+        return NULL;
+    }
+    return self;
+}
+
+static inline cstring_array_interned *cstring_array_interned_new(void) {
+    return cstring_array_interned_new_size(0);
+}
+
+static void cstring_array_interned_destroy(cstring_array_interned *self) {
+    if (self == NULL) return;
+    cstring_array_destroy(self->strings);
+    free(self->slots);
+    free(self);
+}
+
+static inline size_t cstring_array_interned_num_strings(cstring_array_interned *self) {
+    return cstring_array_num_strings(self->strings);
+}
+
+static inline char *cstring_array_interned_get_string(cstring_array_interned *self, uint32_t id) {
+    return cstring_array_get_string(self->strings, id);
+}
+
+static inline uint32_t cstring_array_interned_hash(const char *str, size_t len) {
+    return (uint32_t)cstring_array_hash(str, len, 0);
+}
+
+static inline bool cstring_array_interned_slot_equals(cstring_array_interned *self, cstring_array_interned_slot slot, uint32_t hash, const char *str, size_t len) {
+    if (slot.hash != hash) return false;
+    size_t slot_len;
+    const char *slot_str = cstring_array_get_string_len(self->strings, slot.id - 1, &slot_len);
+    return slot_len == len && memcmp(slot_str, str, len) == 0;
+}
+
+// Slot holding str, or the empty slot where it would be inserted
+static inline size_t cstring_array_interned_find_slot(cstring_array_interned *self, uint32_t hash, const char *str, size_t len) {
+    size_t mask = self->num_slots - 1;
+    size_t i = hash & mask;
+    while (self->slots[i].id != 0 && !cstring_array_interned_slot_equals(self, self->slots[i], hash, str, len)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static bool cstring_array_interned_grow(cstring_array_interned *self) {
+    size_t num_slots = self->num_slots * 2;
+    cstring_array_interned_slot *slots = calloc(num_slots, sizeof(cstring_array_interned_slot));
+    if (slots == NULL) return false;
+
+    size_t mask = num_slots - 1;
+    for (size_t j = 0; j < self->num_slots; j++) {
+        cstring_array_interned_slot slot = self->slots[j];
+        if (slot.id == 0) continue;
+        size_t i = slot.hash & mask;
+        while (slots[i].id != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+    free(self->slots);
+    self->slots = slots;
+    self->num_slots = num_slots;
+    return true;
+}
+
+static inline int64_t cstring_array_interned_lookup_len(cstring_array_interned *self, const char *str, size_t len) {
+    uint32_t hash = cstring_array_interned_hash(str, len);
+    size_t i = cstring_array_interned_find_slot(self, hash, str, len);
+    if (self->slots[i].id == 0) return -1;
+    return (int64_t)self->slots[i].id - 1;
+}
+
+// Id of str if it has been added, -1 otherwise
+static inline int64_t cstring_array_interned_lookup(cstring_array_interned *self, const char *str) {
+    return cstring_array_interned_lookup_len(self, str, strlen(str));
+}
+
+/*
+Returns the id of str, adding it if it isn't present yet. Ids are dense and assigned
+in insertion order, so they index the underlying cstring_array directly. Returns
+CSTRING_ARRAY_INTERNED_NOT_FOUND on allocation failure.
+*/
+static uint32_t cstring_array_interned_add_string_len(cstring_array_interned *self, char *str, size_t len) {
+    uint32_t hash = cstring_array_interned_hash(str, len);
+    size_t i = cstring_array_interned_find_slot(self, hash, str, len);
+    if (self->slots[i].id != 0) return self->slots[i].id - 1;
+
+    size_t id = cstring_array_interned_num_strings(self);
+    if (id >= CSTRING_ARRAY_INTERNED_NOT_FOUND - 1) return CSTRING_ARRAY_INTERNED_NOT_FOUND;
+
+    if ((id + 1) * 4 > self->num_slots * 3) {
+        if (!cstring_array_interned_grow(self)) return CSTRING_ARRAY_INTERNED_NOT_FOUND;
+        i = cstring_array_interned_find_slot(self, hash, str, len);
+    }
+
+    cstring_array_add_string_len(self->strings, str, len);
+    if (cstring_array_num_strings(self->strings) == id) return CSTRING_ARRAY_INTERNED_NOT_FOUND;
+    self->slots[i].hash = hash;
+    self->slots[i].id = (uint32_t)id + 1;
+    return (uint32_t)id;
+}
+
+static inline uint32_t cstring_array_interned_add_string(cstring_array_interned *self, char *str) {
+    return cstring_array_interned_add_string_len(self, str, strlen(str));
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+cstring_array_small is an instantiation for short lists such as argv-like splits and
+few-field records. Offsets are uint16_t, which halves the index memory and limits the
+pool to 64 KiB; adds past that fail as with CSTRING_ARRAY_CHECKED (see can_add).
+
+cstring_array_small_inline embeds the array struct, CSTRING_ARRAY_SMALL_OFFSETS offsets
+and CSTRING_ARRAY_SMALL_BYTES bytes, so an array that stays within them never calls
+malloc. It's usually declared on the stack:
+
+cstring_array_small_inline storage;
+cstring_array_small *fields = cstring_array_small_inline_init(&storage);
+...
+cstring_array_small_destroy(fields);
+
+The whole cstring_array_small API works on the result. Growing past the inline buffers
+spills them to the heap through the array's allocator, and destroy frees only what
+spilled, after which the storage can be initialized again. Since the array points into
+the storage, the storage must not be copied or moved while it's in use.
+
+Define CSTRING_ARRAY_SMALL_OFFSETS and CSTRING_ARRAY_SMALL_BYTES before the first
+include to change the inline sizes. Room for n strings takes n + 1 offsets, one being
+the end sentinel.
+*/
+
+#ifndef CSTRING_ARRAY_SMALL_H
+#define CSTRING_ARRAY_SMALL_H
+
+#define CSTRING_ARRAY_SMALL
+#include "cstring_array_base.h"
+#undef CSTRING_ARRAY_SMALL
+
+#ifndef CSTRING_ARRAY_SMALL_OFFSETS
+#define CSTRING_ARRAY_SMALL_OFFSETS 16
+#endif
+
+#ifndef CSTRING_ARRAY_SMALL_BYTES
+#define CSTRING_ARRAY_SMALL_BYTES 256
+#endif
+
+typedef struct {
+    // First, so the array's allocator pointer leads back to the storage
+    cstring_array_allocator allocator;
+    cstring_array_small array;
+    index_array16 indices;
+    char_array str;
+    uint16_t offsets[CSTRING_ARRAY_SMALL_OFFSETS];
+    char bytes[CSTRING_ARRAY_SMALL_BYTES];
+} cstring_array_small_inline;
+
+static inline bool cstring_array_small_inline_contains(cstring_array_small_inline *self, void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    return p >= (uintptr_t)self && p < (uintptr_t)(self + 1);
+}
+
+/*
+Inline buffers are kept while they're big enough and copied to malloc'd ones once
+they're not. Heap buffers use realloc, which is aligned enough for
+CSTRING_ARRAY_ALIGNMENT of 16, as with char_array.
+*/
+static void *cstring_array_small_inline_realloc(cstring_array_allocator *allocator, void *ptr, size_t old_size, size_t size, size_t alignment) {
+    cstring_array_small_inline *self = (cstring_array_small_inline *)allocator;
+    (void)alignment;
+    if (!cstring_array_small_inline_contains(self, ptr)) return realloc(ptr, size);
+
+    size_t inline_size = ptr == (void *)self->offsets ? sizeof(self->offsets) : (ptr == (void *)self->bytes ? sizeof(self->bytes) : 0);
+    if (size <= inline_size) return ptr;
+    void *new_ptr = malloc(size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    }
+    return new_ptr;
+}
+
+static void cstring_array_small_inline_free(cstring_array_allocator *allocator, void *ptr, size_t size) {
+    (void)size;
+    if (!cstring_array_small_inline_contains((cstring_array_small_inline *)allocator, ptr)) free(ptr);
+}
+
+// Sets up an empty array in self's inline buffers and returns it. Never allocates.
+static cstring_array_small *cstring_array_small_inline_init(cstring_array_small_inline *self) {
+    self->allocator.realloc = cstring_array_small_inline_realloc;
+    self->allocator.free = cstring_array_small_inline_free;
+
+    self->indices.a = self->offsets;
+    self->indices.n = 0;
+    self->indices.m = CSTRING_ARRAY_SMALL_OFFSETS;
+    // The end sentinel, see update_end
+    self->offsets[0] = 0;
+
+    self->str.a = self->bytes;
+    self->str.n = 0;
+    self->str.m = CSTRING_ARRAY_SMALL_BYTES;
+
+    self->array.indices = &self->indices;
+    self->array.str = &self->str;
+    self->array.allocator = &self->allocator;
+    self->array.removed = NULL;
+    return &self->array;
+}
+
+// Whether the array still lives entirely in its inline buffers
+static inline bool cstring_array_small_inline_is_inline(cstring_array_small_inline *self) {
+    return self->indices.a == self->offsets && self->str.a == self->bytes;
+}
+
+#endif
@@ -0,0 +1,510 @@
+/*
+cstring_array_trie is a read-only index over a cstring_array for exact lookup, prefix
+enumeration and longest-prefix match, e.g. over large static vocabularies where scanning
+get_string is too slow. Lookups return ids into the array the trie was built from.
+
+It's a radix trie: runs of single-child nodes are merged into one multi-byte edge, so
+there are at most two nodes per distinct string. Each node is one packed record in a
+single buffer, holding everything a lookup needs at that step:
+
+    cstring_array_trie_node
+    label: the node's edge label past its first byte
+    child_bytes: the first label byte of each child, in order, searched with memchr
+    children: a uint32_t reference to each child's record, 4-byte aligned
+
+so a step down the trie usually costs one cache miss. References are record offsets in
+units of 4 bytes, which lets the buffer grow to 16 GiB. Records are laid out
+breadth-first from the root at reference 0, so children always follow their parent.
+
+ids holds the array's ids in sorted string order, and each node's start and end bound
+the ids of the strings under it, so all strings with a prefix are one range of ids.
+
+The trie copies everything it needs, so the array can be modified or destroyed after
+building it. save and load store the trie in its own file, e.g. next to the array's.
+Where madvise and MADV_HUGEPAGE are declared (glibc needs _GNU_SOURCE), the record buffer
+is advised to use transparent huge pages, as breadth-first order puts each record far
+from its parent's once the trie is large.
+*/
+
+#ifndef CSTRING_ARRAY_TRIE_H
+#define CSTRING_ARRAY_TRIE_H
+
+#include "cstring_array.h"
+
+#define CSTRING_ARRAY_TRIE_NOT_FOUND UINT32_MAX
+#define CSTRING_ARRAY_TRIE_MAX_SIZE ((size_t)UINT32_MAX * sizeof(uint32_t))
+
+typedef struct {
+    // Id of the string ending at this node, CSTRING_ARRAY_TRIE_NOT_FOUND if none
+    uint32_t id;
+    // Range in ids of the strings under this node
+    uint32_t start;
+    uint32_t end;
+    uint32_t label_len;
+    uint32_t num_children;
+} cstring_array_trie_node;
+
+typedef struct {
+    unsigned char *data;
+    size_t data_size;
+    size_t num_nodes;
+    uint32_t *ids;
+    size_t num_ids;
+    // Strings in the array it was built from, removed ones included; every id is below it
+    size_t num_strings;
+} cstring_array_trie;
+
+static inline size_t cstring_array_trie_record_size(size_t label_len, size_t num_children) {
+    return cstring_array_align_up(sizeof(cstring_array_trie_node) + label_len + num_children, sizeof(uint32_t)) + num_children * sizeof(uint32_t);
+}
+
+static inline const cstring_array_trie_node *cstring_array_trie_record(const cstring_array_trie *self, size_t ref) {
+    return (const cstring_array_trie_node *)(self->data + ref * sizeof(uint32_t));
+}
+
+static inline const char *cstring_array_trie_label(const cstring_array_trie_node *node) {
+    return (const char *)(node + 1);
+}
+
+static inline const unsigned char *cstring_array_trie_child_bytes(const cstring_array_trie_node *node) {
+    return (const unsigned char *)(node + 1) + node->label_len;
+}
+
+static inline const uint32_t *cstring_array_trie_children(const cstring_array_trie_node *node) {
+    size_t pos = cstring_array_align_up(sizeof(cstring_array_trie_node) + node->label_len + node->num_children, sizeof(uint32_t));
+    return (const uint32_t *)((const unsigned char *)node + pos);
+}
+
+// Child of node whose edge starts with c, or NULL
+static inline const cstring_array_trie_node *cstring_array_trie_child(const cstring_array_trie *self, const cstring_array_trie_node *node, unsigned char c) {
+    const unsigned char *bytes = cstring_array_trie_child_bytes(node);
+    const unsigned char *hit = memchr(bytes, c, node->num_children);
+    if (hit == NULL) return NULL;
+    return cstring_array_trie_record(self, cstring_array_trie_children(node)[hit - bytes]);
+}
+
+static void cstring_array_trie_destroy(cstring_array_trie *self) {
+    if (self == NULL) return;
+    free(self->data);
+    free(self->ids);
+    free(self);
+}
+
+static void cstring_array_trie_advise(void *ptr, size_t size) {
+#if defined(CSTRING_ARRAY_HAVE_MMAP) && defined(MADV_HUGEPAGE)
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = cstring_array_align_up((uintptr_t)ptr, page_size);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(page_size - 1);
+    if (end > start) madvise((void *)start, end - start, MADV_HUGEPAGE);
+#else
+    (void)ptr;
+    (void)size;
+#endif
+}
+
+static cstring_array_trie *cstring_array_trie_alloc(size_t data_size, size_t num_nodes, size_t num_ids) {
+    cstring_array_trie *self = malloc(sizeof(cstring_array_trie));
+    if (self == NULL) return NULL;
+    self->data_size = data_size;
+    self->num_nodes = num_nodes;
+    self->num_ids = num_ids;
+    self->num_strings = num_ids;
+    self->data = malloc(data_size > 0 ? data_size : 1);
+    self->ids = malloc((num_ids > 0 ? num_ids : 1) * sizeof(uint32_t));
+    if (self->data == NULL || self->ids == NULL) {
+        cstring_array_trie_destroy(self);
+        return NULL;
+    }
+    cstring_array_trie_advise(self->data, data_size);
+    return self;
+}
+
+// A node while building, whose strings are sorted strings [start, end)
+typedef struct {
+    uint32_t first_child;
+    uint32_t num_children;
+    uint32_t id;
+    uint32_t start;
+    uint32_t end;
+    // Length of the prefix the node's strings share, which ends with the label
+    uint32_t depth;
+    uint32_t label_len;
+} cstring_array_trie_build_node;
+
+static inline size_t cstring_array_trie_entry_len(cstring_array *array, const cstring_array_sort_entry *entry) {
+    const uint32_t *offsets = array->indices->a;
+    return (size_t)(offsets[entry->id + 1] - offsets[entry->id]) - 1;
+}
+
+/*
+Lays the trie out breadth-first: nodes are processed in index order, each appending its
+children, one per distinct byte following the node's prefix, with an edge running as
+far as the child's strings agree. Returns the number of nodes.
+*/
+static size_t cstring_array_trie_build_nodes(cstring_array *array, const cstring_array_sort_entry *entries, size_t n, cstring_array_trie_build_node *nodes) {
+    const char *base = array->str->a;
+    nodes[0].start = 0;
+    nodes[0].end = (uint32_t)n;
+    nodes[0].depth = 0;
+    nodes[0].label_len = 0;
+    size_t num_nodes = 1;
+
+    for (size_t i = 0; i < num_nodes; i++) {
+        cstring_array_trie_build_node *node = &nodes[i];
+        size_t depth = node->depth;
+        size_t j = node->start, end = node->end;
+        node->first_child = (uint32_t)num_nodes;
+
+        // Strings ending here sort before the ones that continue
+        node->id = CSTRING_ARRAY_TRIE_NOT_FOUND;
+        for (; j < end && cstring_array_trie_entry_len(array, &entries[j]) == depth; j++) {
+            if (entries[j].id < node->id) node->id = (uint32_t)entries[j].id;
+        }
+
+        while (j < end) {
+            const char *first = base + entries[j].offset;
+            unsigned char c = (unsigned char)first[depth];
+            size_t group_end = j + 1;
+            while (group_end < end && (unsigned char)base[entries[group_end].offset + depth] == c) {
+                group_end++;
+            }
+
+            // The group shares as many bytes as its first and last strings do
+            const char *last = base + entries[group_end - 1].offset;
+            size_t first_len = cstring_array_trie_entry_len(array, &entries[j]);
+            size_t last_len = cstring_array_trie_entry_len(array, &entries[group_end - 1]);
+            size_t min_len = first_len < last_len ? first_len : last_len;
+            size_t child_depth = depth + 1;
+            while (child_depth < min_len && first[child_depth] == last[child_depth]) {
+                child_depth++;
+            }
+
+            nodes[num_nodes].start = (uint32_t)j;
+            nodes[num_nodes].end = (uint32_t)group_end;
+            nodes[num_nodes].depth = (uint32_t)child_depth;
+            nodes[num_nodes].label_len = (uint32_t)(child_depth - depth - 1);
+            num_nodes++;
+            j = group_end;
+        }
+        node->num_children = (uint32_t)(num_nodes - node->first_child);
+    }
+    return num_nodes;
+}
+
+// Writes node i's record, its children's references already known
+static void cstring_array_trie_pack_node(cstring_array_trie *self, cstring_array *array, const cstring_array_sort_entry *entries, const cstring_array_trie_build_node *nodes, const uint32_t *refs, size_t i) {
+    const char *base = array->str->a;
+    const cstring_array_trie_build_node *build = &nodes[i];
+    cstring_array_trie_node *node = (cstring_array_trie_node *)(self->data + (size_t)refs[i] * sizeof(uint32_t));
+    node->id = build->id;
+    node->start = build->start;
+    node->end = build->end;
+    node->label_len = build->label_len;
+    node->num_children = build->num_children;
+    // The root of an empty trie has no entry to copy a label from
+    if (build->label_len > 0 && build->start < build->end) {
+        memcpy(node + 1, base + entries[build->start].offset + build->depth - build->label_len, build->label_len);
+    }
+
+    unsigned char *child_bytes = (unsigned char *)(node + 1) + build->label_len;
+    uint32_t *children = (uint32_t *)cstring_array_trie_children(node);
+    for (size_t k = 0; k < build->num_children; k++) {
+        const cstring_array_trie_build_node *child = &nodes[build->first_child + k];
+        child_bytes[k] = (unsigned char)base[entries[child->start].offset + build->depth];
+        children[k] = refs[build->first_child + k];
+    }
+    // Zeroes the alignment padding, so saved files are reproducible
+    unsigned char *padding = child_bytes + build->num_children;
+    memset(padding, 0, (size_t)((unsigned char *)children - padding));
+}
+
+/*
+Builds a trie over the strings of array. Duplicate strings are all listed by prefix
+enumeration, and exact lookup returns the smallest of their ids. Removed strings are
+left out. Returns NULL on allocation failure.
+*/
+static cstring_array_trie *cstring_array_trie_new(cstring_array *array) {
+    if (array == NULL) return NULL;
+    cstring_array_sort_entry *entries = cstring_array_sorted_entries(array);
+    if (entries == NULL) return NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < cstring_array_num_strings(array); i++) {
+        if (!cstring_array_is_removed(array, entries[i].id)) {
+            entries[n++] = entries[i];
+        }
+    }
+
+    // A radix trie has at most 2n nodes counting the root
+    cstring_array_trie_build_node *nodes = malloc((2 * n + 1) * sizeof(cstring_array_trie_build_node));
+    uint32_t *refs = malloc((2 * n + 1) * sizeof(uint32_t));
+    cstring_array_trie *self = NULL;
+    if (nodes != NULL && refs != NULL) {
+        size_t num_nodes = cstring_array_trie_build_nodes(array, entries, n, nodes);
+
+        // Records go in node order, so each reference is the size of the records before it
+        size_t data_size = 0;
+        for (size_t i = 0; i < num_nodes && data_size <= CSTRING_ARRAY_TRIE_MAX_SIZE; i++) {
+            refs[i] = (uint32_t)(data_size / sizeof(uint32_t));
+            data_size += cstring_array_trie_record_size(nodes[i].label_len, nodes[i].num_children);
+        }
+        if (data_size <= CSTRING_ARRAY_TRIE_MAX_SIZE) {
+            self = cstring_array_trie_alloc(data_size, num_nodes, n);
+        }
+        if (self != NULL) self->num_strings = cstring_array_num_strings(array);
+        if (self != NULL) {
+            for (size_t i = 0; i < num_nodes; i++) {
+                cstring_array_trie_pack_node(self, array, entries, nodes, refs, i);
+            }
+            for (size_t j = 0; j < n; j++) {
+                self->ids[j] = (uint32_t)entries[j].id;
+            }
+        }
+    }
+
+    free(refs);
+    free(nodes);
+    free(entries);
+    return self;
+}
+
+static inline size_t cstring_array_trie_num_strings(cstring_array_trie *self) {
+    return self->num_ids;
+}
+
+// Bytes used by the records and ids
+static inline size_t cstring_array_trie_memory_size(cstring_array_trie *self) {
+    return sizeof(cstring_array_trie) + self->data_size + self->num_ids * sizeof(uint32_t);
+}
+
+/*
+Follows key from the root as far as it matches and returns the number of bytes matched.
+*node is the deepest node reached, and *boundary whether the match ended on that node
+rather than partway along its edge. A key that runs out partway along an edge still
+selects the edge's node, since every string under it starts with the key.
+*/
+static size_t cstring_array_trie_walk(cstring_array_trie *self, const char *key, size_t len, const cstring_array_trie_node **node, bool *boundary) {
+    const cstring_array_trie_node *current = cstring_array_trie_record(self, 0);
+    size_t pos = 0;
+    *boundary = true;
+    while (pos < len) {
+        const cstring_array_trie_node *child = cstring_array_trie_child(self, current, (unsigned char)key[pos]);
+        if (child == NULL) break;
+        pos++;
+        const char *label = cstring_array_trie_label(child);
+        size_t cmp = child->label_len < len - pos ? child->label_len : len - pos;
+        size_t matched = 0;
+        while (matched < cmp && label[matched] == key[pos + matched]) {
+            matched++;
+        }
+        pos += matched;
+        if (matched < child->label_len) {
+            if (pos == len) {
+                current = child;
+                *boundary = false;
+            }
+            break;
+        }
+        current = child;
+    }
+    *node = current;
+    return pos;
+}
+
+static int64_t cstring_array_trie_lookup_len(cstring_array_trie *self, const char *key, size_t len) {
+    const cstring_array_trie_node *node;
+    bool boundary;
+    if (cstring_array_trie_walk(self, key, len, &node, &boundary) < len || !boundary) return -1;
+    return node->id == CSTRING_ARRAY_TRIE_NOT_FOUND ? -1 : (int64_t)node->id;
+}
+
+// Id of a string equal to key, -1 if there's none
+static inline int64_t cstring_array_trie_lookup(cstring_array_trie *self, const char *key) {
+    return cstring_array_trie_lookup_len(self, key, strlen(key));
+}
+
+/*
+Sets *ids to the ids of every string starting with the len bytes of prefix, in sorted
+string order, and returns how many there are. *ids points into the trie, so nothing is
+copied. The empty prefix lists every string.
+*/
+static size_t cstring_array_trie_prefix_len(cstring_array_trie *self, const char *prefix, size_t len, const uint32_t **ids) {
+    const cstring_array_trie_node *node;
+    bool boundary;
+    *ids = self->ids;
+    if (cstring_array_trie_walk(self, prefix, len, &node, &boundary) < len) return 0;
+    *ids = self->ids + node->start;
+    return node->end - node->start;
+}
+
+static inline size_t cstring_array_trie_prefix(cstring_array_trie *self, const char *prefix, const uint32_t **ids) {
+    return cstring_array_trie_prefix_len(self, prefix, strlen(prefix), ids);
+}
+
+/*
+Id of the longest string that is a prefix of the len bytes of key, e.g. for routing
+tables and tokenizers, or -1 if there's none. Its length goes in *match_len.
+*/
+static int64_t cstring_array_trie_longest_prefix_len(cstring_array_trie *self, const char *key, size_t len, size_t *match_len) {
+    int64_t result = -1;
+    *match_len = 0;
+    const cstring_array_trie_node *node = cstring_array_trie_record(self, 0);
+    size_t pos = 0;
+    while (true) {
+        if (node->id != CSTRING_ARRAY_TRIE_NOT_FOUND) {
+            result = (int64_t)node->id;
+            *match_len = pos;
+        }
+        if (pos == len) break;
+        const cstring_array_trie_node *child = cstring_array_trie_child(self, node, (unsigned char)key[pos]);
+        if (child == NULL || child->label_len > len - pos - 1) break;
+        if (memcmp(cstring_array_trie_label(child), key + pos + 1, child->label_len) != 0) break;
+        pos += 1 + child->label_len;
+        node = child;
+    }
+    return result;
+}
+
+static inline int64_t cstring_array_trie_longest_prefix(cstring_array_trie *self, const char *key, size_t *match_len) {
+    return cstring_array_trie_longest_prefix_len(self, key, strlen(key), match_len);
+}
+
+/*
+On-disk format written by cstring_array_trie_save, sections back to back:
+
+    header
+    data: data_size bytes of records
+    ids: num_ids uint32_t
+
+Integers are in native byte order, checked with byte_order_mark as for arrays. The
+checksum chains cstring_array_hash over data, ids and num_strings. num_strings bounds the ids, so a
+loaded trie never returns one past the end of the array it was built from.
+*/
+#define CSTRING_ARRAY_TRIE_FILE_MAGIC "CSTRTRI"
+#define CSTRING_ARRAY_TRIE_FILE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint64_t data_size;
+    uint64_t num_nodes;
+    uint64_t num_ids;
+    uint64_t num_strings;
+    uint64_t checksum;
+} cstring_array_trie_file_header;
+
+static uint64_t cstring_array_trie_checksum(cstring_array_trie *self) {
+    uint64_t checksum = cstring_array_hash(self->data, self->data_size, 0);
+    checksum = cstring_array_hash(self->ids, self->num_ids * sizeof(uint32_t), checksum);
+    uint64_t num_strings = self->num_strings;
+    return cstring_array_hash(&num_strings, sizeof(num_strings), checksum);
+}
+
+static bool cstring_array_trie_save(cstring_array_trie *self, const char *path) {
+    if (self == NULL || path == NULL) return false;
+
+    cstring_array_trie_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CSTRING_ARRAY_TRIE_FILE_MAGIC, sizeof(CSTRING_ARRAY_TRIE_FILE_MAGIC));
+    header.version = CSTRING_ARRAY_TRIE_FILE_VERSION;
+    header.byte_order_mark = CSTRING_ARRAY_FILE_BYTE_ORDER_MARK;
+    header.data_size = self->data_size;
+    header.num_nodes = self->num_nodes;
+    header.num_ids = self->num_ids;
+    header.num_strings = self->num_strings;
+    header.checksum = cstring_array_trie_checksum(self);
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(self->data, 1, self->data_size, f) == self->data_size
+        && (self->num_ids == 0 || fwrite(self->ids, sizeof(uint32_t), self->num_ids, f) == self->num_ids);
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
+
+/*
+Whether the records tile data exactly and the children references, read in order, are
+the starts of every record after the root, also in order. Each child then comes after
+its parent, so no walk can leave the buffer or loop. Every id, in the nodes and in ids,
+must also be below num_strings.
+*/
+static bool cstring_array_trie_valid(cstring_array_trie *self) {
+    size_t num_nodes = 0;
+    // The next child reference to check is child k of the record at parent
+    size_t parent = 0, k = 0;
+    size_t pos = 0;
+    while (pos < self->data_size) {
+        if (self->data_size - pos < sizeof(cstring_array_trie_node)) return false;
+        const cstring_array_trie_node *node = (const cstring_array_trie_node *)(self->data + pos);
+        if (node->start > node->end || node->end > self->num_ids || node->num_children > 256) return false;
+        if (node->id != CSTRING_ARRAY_TRIE_NOT_FOUND && node->id >= self->num_strings) return false;
+        if (node->label_len > self->data_size - pos) return false;
+        size_t size = cstring_array_trie_record_size(node->label_len, node->num_children);
+        if (size > self->data_size - pos) return false;
+
+        if (pos > 0) {
+            const cstring_array_trie_node *p = (const cstring_array_trie_node *)(self->data + parent);
+            while (k == p->num_children) {
+                parent += cstring_array_trie_record_size(p->label_len, p->num_children);
+                k = 0;
+                if (parent >= pos) return false;
+                p = (const cstring_array_trie_node *)(self->data + parent);
+            }
+            if ((size_t)cstring_array_trie_children(p)[k++] * sizeof(uint32_t) != pos) return false;
+        }
+        pos += size;
+        num_nodes++;
+    }
+    if (num_nodes == 0 || num_nodes != self->num_nodes) return false;
+
+    // No references left over past the last record
+    while (parent < self->data_size) {
+        const cstring_array_trie_node *p = (const cstring_array_trie_node *)(self->data + parent);
+        if (k < p->num_children) return false;
+        parent += cstring_array_trie_record_size(p->label_len, p->num_children);
+        k = 0;
+    }
+
+    for (size_t j = 0; j < self->num_ids; j++) {
+        if (self->ids[j] >= self->num_strings) return false;
+    }
+    return true;
+}
+
+// Reads a trie written by save, or returns NULL if the file is missing, truncated or corrupt
+static cstring_array_trie *cstring_array_trie_load(const char *path) {
+    if (path == NULL) return NULL;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    cstring_array_trie_file_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || memcmp(header.magic, CSTRING_ARRAY_TRIE_FILE_MAGIC, sizeof(CSTRING_ARRAY_TRIE_FILE_MAGIC)) != 0
+        || header.version != CSTRING_ARRAY_TRIE_FILE_VERSION
+        || header.byte_order_mark != CSTRING_ARRAY_FILE_BYTE_ORDER_MARK
+        || header.data_size > CSTRING_ARRAY_TRIE_MAX_SIZE || header.data_size % sizeof(uint32_t) != 0
+        || header.num_nodes > header.data_size || header.num_ids > header.num_strings || header.num_strings >= UINT32_MAX) {
+        fclose(f);
+        return NULL;
+    }
+
+    cstring_array_trie *self = cstring_array_trie_alloc((size_t)header.data_size, (size_t)header.num_nodes, (size_t)header.num_ids);
+    if (self == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    self->num_strings = (size_t)header.num_strings;
+    bool ok = fread(self->data, 1, self->data_size, f) == self->data_size
+        && (self->num_ids == 0 || fread(self->ids, sizeof(uint32_t), self->num_ids, f) == self->num_ids);
+    fclose(f);
+
+    if (!ok || cstring_array_trie_checksum(self) != header.checksum || !cstring_array_trie_valid(self)) {
+        cstring_array_trie_destroy(self);
+        return NULL;
+    }
+    return self;
+}
+
+#endif
@@ -1,6 +1,13 @@
 #include "greatest/greatest.h"
 #include "cstring_array.h"
 #include "cstring_array_aligned.h"
+#include "cstring_array64.h"
+#include "cstring_array_interned.h"
+#include "cstring_array_frozen.h"
+#include "cstring_array_concurrent.h"
+#include "cstring_array_hugepage.h"
+#include "cstring_array_small.h"
+#include "cstring_array_trie.h"
 
 TEST test_cstring_array_new(void) {
     cstring_array *array = cstring_array_new();
@@ -288,6 +295,1560 @@ TEST test_cstring_array_aligned_from_strings(void) {
     PASS();
 }
 
+TEST test_cstring_array_from_char_array_long(void) {
+    char_array *str = char_array_new();
+    char buf[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(buf, "str%d", i);
+        char_array_append(str, buf);
+        char_array_terminate(str);
+    }
+    cstring_array *array = cstring_array_from_char_array(str);
+    ASSERT_EQ(cstring_array_num_strings(array), 100);
+    for (int i = 0; i < 100; i++) {
+        sprintf(buf, "str%d", i);
+        ASSERT_STR_EQ(cstring_array_get_string(array, i), buf);
+    }
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_from_char_array_long(void) {
+    char_array_aligned *str = char_array_aligned_new();
+    char buf[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(buf, "str%d", i);
+        char_array_aligned_append(str, buf);
+        char_array_aligned_terminate(str);
+    }
+    cstring_array_aligned *array = cstring_array_aligned_from_char_array(str);
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 100);
+    for (int i = 0; i < 100; i++) {
+        sprintf(buf, "str%d", i);
+        ASSERT_STR_EQ(cstring_array_aligned_get_string(array, i), buf);
+    }
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_split_no_copy(void) {
+    const char *input = "the,quick,brown,fox,jumps,over,the,lazy,dog,and,keeps,running,through,the,field,";
+    char *str = malloc(strlen(input) + 1);
+    strcpy(str, input);
+    size_t count = 0;
+    cstring_array *array = cstring_array_split_no_copy(str, ',', &count);
+    ASSERT_EQ(count, 15);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "the");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 12), "through");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 14), "field");
+    ASSERT_EQ(str[3], '\0');
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_split_no_copy(void) {
+    char *str = malloc(7);
+    strcpy(str, "a b  c");
+    size_t count = 0;
+    cstring_array_aligned *array = cstring_array_aligned_split_no_copy(str, ' ', &count);
+    ASSERT_EQ(count, 4);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "a");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 2), "");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 3), "c");
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array64_new(void) {
+    cstring_array64 *array = cstring_array64_new();
+    ASSERT(array != NULL);
+    ASSERT_EQ(array->indices->n, 0);
+    ASSERT_EQ(array->str->n, 0);
+    ASSERT_EQ(sizeof(array->indices->a[0]), sizeof(uint64_t));
+    cstring_array64_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array64_add_string(void) {
+    cstring_array64 *array = cstring_array64_new_size(10);
+    uint64_t index = cstring_array64_add_string(array, "hello");
+    ASSERT_EQ(index, 0);
+    index = cstring_array64_add_string_len(array, "world!", 5);
+    ASSERT_EQ(index, 6);
+    ASSERT_EQ(cstring_array64_get_offset(array, 1), 6);
+    ASSERT_STR_EQ(cstring_array64_get_string(array, 1), "world");
+    ASSERT_EQ(cstring_array64_token_length(array, 1), 5);
+    cstring_array64_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array64_from_strings(void) {
+    cstring_array64 *array = cstring_array64_from_strings((char *[]){"hello", "world"}, 2);
+    ASSERT_EQ(array->indices->n, 2);
+    ASSERT_EQ(array->str->n, 12);
+    ASSERT_STR_EQ(cstring_array64_get_string(array, 1), "world");
+    cstring_array64_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_save_mmap_open(void) {
+    const char *path = "test_cstring_array.bin";
+    cstring_array *array = cstring_array_from_strings((char *[]){"foo", "", "barbaz"}, 3);
+    ASSERT(cstring_array_save(array, path));
+
+    cstring_array *mapped = cstring_array_mmap_open_options(path, true);
+    ASSERT(mapped != NULL);
+    ASSERT_EQ(cstring_array_num_strings(mapped), 3);
+    ASSERT_EQ(mapped->str->n, array->str->n);
+    ASSERT_EQ((uintptr_t)mapped->indices->a % 64, 0);
+    ASSERT_EQ((uintptr_t)mapped->str->a % 64, 0);
+    ASSERT_STR_EQ(cstring_array_get_string(mapped, 0), "foo");
+    ASSERT_STR_EQ(cstring_array_get_string(mapped, 1), "");
+    ASSERT_STR_EQ(cstring_array_get_string(mapped, 2), "barbaz");
+    ASSERT_EQ(cstring_array_token_length(mapped, 2), 6);
+    cstring_array_mmap_close(mapped);
+
+    // Offset widths must match
+    ASSERT_EQ(cstring_array64_mmap_open(path), NULL);
+
+    // Removed strings are left out of the file but not dropped from the array
+    cstring_array_add_string(array, "qux");
+    ASSERT(cstring_array_set_max_garbage_ratio(array, 1.0));
+    ASSERT(cstring_array_remove(array, 0));
+    ASSERT(cstring_array_remove(array, 2));
+    ASSERT(cstring_array_save(array, path));
+    ASSERT_EQ(cstring_array_num_removed(array), 2);
+    ASSERT_EQ(cstring_array_num_strings(array), 4);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 3), "qux");
+    mapped = cstring_array_mmap_open_options(path, true);
+    ASSERT(mapped != NULL);
+    ASSERT_EQ(cstring_array_num_strings(mapped), 2);
+    ASSERT_EQ(mapped->str->n, 5);
+    ASSERT_STR_EQ(cstring_array_get_string(mapped, 0), "");
+    ASSERT_STR_EQ(cstring_array_get_string(mapped, 1), "qux");
+    cstring_array_mmap_close(mapped);
+
+    // Offsets are checked even without the checksum
+    FILE *f = fopen(path, "r+b");
+    ASSERT(f != NULL);
+    uint32_t bad_offset = 1000;
+    ASSERT_EQ(fseek(f, 64 + sizeof(uint32_t), SEEK_SET), 0);
+    ASSERT_EQ(fwrite(&bad_offset, sizeof(bad_offset), 1, f), 1);
+    ASSERT_EQ(fclose(f), 0);
+    ASSERT_EQ(cstring_array_mmap_open(path), NULL);
+
+    cstring_array_destroy(array);
+    remove(path);
+    PASS();
+}
+
+TEST test_cstring_array64_save_mmap_open(void) {
+    const char *path = "test_cstring_array64.bin";
+    cstring_array64 *array = cstring_array64_new();
+    ASSERT(cstring_array64_save(array, path));
+    cstring_array64 *mapped = cstring_array64_mmap_open(path);
+    ASSERT(mapped != NULL);
+    ASSERT_EQ(cstring_array64_num_strings(mapped), 0);
+    cstring_array64_mmap_close(mapped);
+
+    cstring_array64_add_string(array, "hello");
+    ASSERT(cstring_array64_save(array, path));
+    mapped = cstring_array64_mmap_open(path);
+    ASSERT(mapped != NULL);
+    ASSERT_STR_EQ(cstring_array64_get_string(mapped, 0), "hello");
+    cstring_array64_mmap_close(mapped);
+
+    cstring_array64_destroy(array);
+    remove(path);
+    PASS();
+}
+
+static char *random_tokens(size_t len, const char *separator, unsigned seed) {
+    char *str = malloc(len + 1);
+    size_t separator_len = strlen(separator);
+    srand(seed);
+    size_t i = 0;
+    while (i < len) {
+        if (rand() % 6 == 0 && i + separator_len <= len) {
+            memcpy(str + i, separator, separator_len);
+            i += separator_len;
+        } else {
+            str[i++] = 'a' + rand() % 3;
+        }
+    }
+    str[len] = '\0';
+    return str;
+}
+
+TEST test_cstring_array_split_parallel(void) {
+    const char *separators[] = {",", "ab", "|||"};
+    for (size_t s = 0; s < 3; s++) {
+        char *str = random_tokens(1 << 20, separators[s], (unsigned)s);
+        size_t separator_len = strlen(separators[s]);
+        for (int ignore = 0; ignore <= 1; ignore++) {
+            size_t expected_count = 0, count = 0;
+            cstring_array *expected = cstring_array_split_options(str, separators[s], separator_len, ignore, &expected_count);
+            cstring_array *array = cstring_array_split_parallel_options(str, separators[s], separator_len, ignore, 8, &count);
+            ASSERT(array != NULL);
+            ASSERT_EQ(count, expected_count);
+            ASSERT_EQ(array->str->n, expected->str->n);
+            ASSERT_MEM_EQ(array->str->a, expected->str->a, expected->str->n);
+            ASSERT_MEM_EQ(array->indices->a, expected->indices->a, expected->indices->n * sizeof(uint32_t));
+            cstring_array_destroy(expected);
+            cstring_array_destroy(array);
+        }
+        free(str);
+    }
+    PASS();
+}
+
+TEST test_cstring_array_aligned_split_parallel(void) {
+    // Leading separators in the first chunks must not produce empty tokens
+    size_t len = 1 << 20;
+    char *str = malloc(len + 1);
+    memset(str, ',', len);
+    memcpy(str + len - 5, "a,,b,", 5);
+    str[len] = '\0';
+    for (int ignore = 0; ignore <= 1; ignore++) {
+        size_t count = 0;
+        cstring_array_aligned *array = cstring_array_aligned_split_parallel_options(str, ",", 1, ignore, 4, &count);
+        ASSERT_EQ(count, ignore ? 3 : 4);
+        ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "a");
+        ASSERT_STR_EQ(cstring_array_aligned_get_string(array, ignore ? 1 : 2), "b");
+        cstring_array_aligned_destroy(array);
+    }
+    free(str);
+    PASS();
+}
+
+TEST test_cstring_array_extend(void) {
+    cstring_array *array = cstring_array_from_strings((char *[]){"hello"}, 1);
+    cstring_array *other = cstring_array_from_strings((char *[]){"foo", "", "barbaz"}, 3);
+    ASSERT(cstring_array_extend(array, other));
+    ASSERT_EQ(cstring_array_num_strings(array), 4);
+    ASSERT_EQ(array->str->n, 18);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "foo");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 2), "");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 3), "barbaz");
+    ASSERT_EQ(cstring_array_token_length(array, 3), 6);
+
+    ASSERT(cstring_array_extend(array, array));
+    ASSERT_EQ(cstring_array_num_strings(array), 8);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 7), "barbaz");
+    cstring_array_destroy(array);
+    cstring_array_destroy(other);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_extend_range(void) {
+    cstring_array_aligned *array = cstring_array_aligned_new();
+    cstring_array_aligned *other = cstring_array_aligned_new();
+    char buf[16];
+    for (int i = 0; i < 40; i++) {
+        sprintf(buf, "s%d", i);
+        cstring_array_aligned_add_string(other, buf);
+    }
+    ASSERT(cstring_array_aligned_extend_range(array, other, 5, 25));
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 20);
+    ASSERT_EQ(cstring_array_aligned_get_offset(array, 0), 0);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "s5");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 19), "s24");
+    ASSERT(cstring_array_aligned_extend_range(array, other, 39, 100));
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 20), "s39");
+    ASSERT_EQ(array->str->a[array->str->n - 1], '\0');
+    cstring_array_aligned_destroy(array);
+    cstring_array_aligned_destroy(other);
+    PASS();
+}
+
+TEST test_cstring_array_interned_add_string(void) {
+    cstring_array_interned *interned = cstring_array_interned_new();
+    ASSERT_EQ(cstring_array_interned_add_string(interned, "foo"), 0);
+    ASSERT_EQ(cstring_array_interned_add_string(interned, "bar"), 1);
+    ASSERT_EQ(cstring_array_interned_add_string(interned, "foo"), 0);
+    ASSERT_EQ(cstring_array_interned_add_string_len(interned, "barbaz", 3), 1);
+    ASSERT_EQ(cstring_array_interned_add_string(interned, ""), 2);
+    ASSERT_EQ(cstring_array_interned_num_strings(interned), 3);
+    ASSERT_EQ(interned->strings->str->n, 9);
+
+    char buf[16];
+    for (int i = 0; i < 1000; i++) {
+        sprintf(buf, "s%d", i % 100);
+        ASSERT_EQ(cstring_array_interned_add_string(interned, buf), 3 + i % 100);
+    }
+    ASSERT_EQ(cstring_array_interned_num_strings(interned), 103);
+    ASSERT_STR_EQ(cstring_array_interned_get_string(interned, 52), "s49");
+    cstring_array_interned_destroy(interned);
+    PASS();
+}
+
+TEST test_cstring_array_interned_lookup(void) {
+    cstring_array_interned *interned = cstring_array_interned_new_size(100);
+    cstring_array_interned_add_string(interned, "foo");
+    cstring_array_interned_add_string(interned, "bar");
+    ASSERT_EQ(cstring_array_interned_lookup(interned, "bar"), 1);
+    ASSERT_EQ(cstring_array_interned_lookup(interned, "ba"), -1);
+    ASSERT_EQ(cstring_array_interned_lookup(interned, "baz"), -1);
+    ASSERT_EQ(cstring_array_interned_lookup_len(interned, "foobar", 3), 0);
+    cstring_array_interned_destroy(interned);
+    PASS();
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+TEST test_cstring_array_sort(void) {
+    cstring_array *array = cstring_array_new();
+    char *expected[2000];
+    char buf[64];
+    srand(7);
+    for (int i = 0; i < 2000; i++) {
+        // Long shared prefixes exercise re-keying past the first 8 bytes
+        int len = sprintf(buf, "%s%d", i % 3 == 0 ? "common_prefix_long_" : "", rand() % 500);
+        if (i % 7 == 0) buf[len - 1] = (char)0xE9;
+        cstring_array_add_string(array, buf);
+        expected[i] = malloc(strlen(buf) + 1);
+        strcpy(expected[i], buf);
+    }
+    qsort(expected, 2000, sizeof(char *), compare_strings);
+    ASSERT(cstring_array_sort(array));
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_STR_EQ(cstring_array_get_string(array, i), expected[i]);
+        ASSERT_EQ(cstring_array_token_length(array, i), (int64_t)strlen(expected[i]));
+        free(expected[i]);
+    }
+    cstring_array_destroy(array);
+
+    // The order alone, with nothing moved and removed strings left out
+    array = cstring_array_from_strings((char *[]){"pear", "fig", "apple", "kiwi", "banana"}, 5);
+    ASSERT(cstring_array_set_max_garbage_ratio(array, 1.0));
+    ASSERT(cstring_array_remove(array, 3));
+    size_t ids[5];
+    ASSERT_EQ(cstring_array_sort_ids(array, ids), 4);
+    ASSERT_EQ(ids[0], 2);
+    ASSERT_EQ(ids[1], 4);
+    ASSERT_EQ(ids[2], 1);
+    ASSERT_EQ(ids[3], 0);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "pear");
+    ASSERT_EQ(cstring_array_num_removed(array), 1);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_bsearch(void) {
+    cstring_array_aligned *array = cstring_array_aligned_from_strings((char *[]){"cat", "car", "ca", "dog", "cart", "a"}, 6);
+    ASSERT(cstring_array_aligned_sort(array));
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "a");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 5), "dog");
+    ASSERT_EQ(cstring_array_aligned_bsearch(array, "car"), 2);
+    ASSERT_EQ(cstring_array_aligned_bsearch(array, "ca"), 1);
+    ASSERT_EQ(cstring_array_aligned_bsearch(array, "c"), -1);
+    ASSERT_EQ(cstring_array_aligned_bsearch(array, "zebra"), -1);
+    ASSERT_EQ(cstring_array_aligned_lower_bound(array, "cb", 2), 5);
+
+    size_t start, end;
+    cstring_array_aligned_prefix_range(array, "car", 3, &start, &end);
+    ASSERT_EQ(start, 2);
+    ASSERT_EQ(end, 4);
+    cstring_array_aligned_prefix_range(array, "b", 1, &start, &end);
+    ASSERT_EQ(start, end);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_view(void) {
+    cstring_array *array = cstring_array_from_strings((char *[]){"a", "bb", "", "dddd", "eeeee"}, 5);
+    cstring_array_view view = cstring_array_as_view(array);
+    ASSERT_EQ(cstring_array_view_num_strings(view), 5);
+
+    size_t i = 0, len = 0, total = 0;
+    char *str;
+    while (cstring_array_view_next(view, &i, &str, &len)) {
+        ASSERT_EQ(len, strlen(str));
+        total += len;
+    }
+    ASSERT_EQ(i, 5);
+    ASSERT_EQ(total, 12);
+
+    cstring_array_view sub = cstring_array_view_subrange(view, 1, 4);
+    ASSERT_EQ(cstring_array_view_num_strings(sub), 3);
+    ASSERT_STR_EQ(cstring_array_view_get_string(sub, 0, &len), "bb");
+    ASSERT_EQ(len, 2);
+    ASSERT_STR_EQ(cstring_array_view_get_string(sub, 2, &len), "dddd");
+    ASSERT_EQ(len, 4);
+    ASSERT_EQ(cstring_array_view_get_string(sub, 3, &len), NULL);
+
+    cstring_array_view tail = cstring_array_view_range(array, 3, 100);
+    ASSERT_STR_EQ(cstring_array_view_get_string(tail, 1, &len), "eeeee");
+    ASSERT_EQ(len, 5);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_to_strings_borrowed(void) {
+    cstring_array_aligned *array = cstring_array_aligned_from_strings((char *[]){"hello", "world"}, 2);
+    char **strings = cstring_array_aligned_to_strings_borrowed(array);
+    ASSERT_STR_EQ(strings[0], "hello");
+    ASSERT_STR_EQ(strings[1], "world");
+    ASSERT_EQ(strings[1], array->str->a + 6);
+    free(strings);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_new_arena(void) {
+    static char buffer[4096];
+    cstring_array_arena arena;
+    cstring_array_arena_init(&arena, buffer, sizeof(buffer));
+
+    cstring_array *array = cstring_array_new_arena(&arena, 2, 8);
+    ASSERT(array != NULL);
+    char word[32];
+    for (int i = 0; i < 100; i++) {
+        snprintf(word, sizeof(word), "word%d", i);
+        size_t used = cstring_array_used(array);
+        ASSERT_EQ(cstring_array_add_string(array, word), used);
+    }
+    cstring_array_start_token(array);
+    cstring_array_append_string(array, "ab");
+    cstring_array_cat_string(array, "cd");
+    ASSERT_EQ(cstring_array_num_strings(array), 101);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "word0");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 99), "word99");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 100), "abcd");
+    ASSERT((char *)array->str->a >= buffer && (char *)array->str->a < buffer + sizeof(buffer));
+
+    ASSERT(cstring_array_new_arena(&arena, 1000, 1000) == NULL);
+    cstring_array_destroy(array);
+    cstring_array_arena_reset(&arena);
+    ASSERT_EQ(arena.used, 0);
+    array = cstring_array_new_arena(&arena, 500, 1000);
+    ASSERT(array != NULL);
+    ASSERT_EQ(cstring_array_num_strings(array), 0);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_new_arena(void) {
+    static char buffer[4096];
+    cstring_array_arena arena;
+    cstring_array_arena_init(&arena, buffer + 1, sizeof(buffer) - 1);
+
+    cstring_array_aligned *array = cstring_array_aligned_new_arena(&arena, 4, 16);
+    ASSERT(array != NULL);
+    ASSERT_EQ((uintptr_t)array->str->a % 64, 0);
+    cstring_array_aligned_add_string(array, "foo");
+    cstring_array_aligned_add_string_len(array, "barbaz", 3);
+    ASSERT(cstring_array_aligned_sort(array));
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "bar");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 1), "foo");
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+static FILE *temp_file_with(const char *str) {
+    FILE *file = tmpfile();
+    fwrite(str, 1, strlen(str), file);
+    rewind(file);
+    return file;
+}
+
+TEST test_cstring_array_split_stream(void) {
+    const char *separators[] = {",", "ab", "aab"};
+    for (size_t s = 0; s < 3; s++) {
+        char *str = random_tokens(10000, separators[s], (unsigned)s + 10);
+        size_t separator_len = strlen(separators[s]);
+        FILE *file = temp_file_with(str);
+        for (size_t chunk_size = 1; chunk_size <= 9; chunk_size += 4) {
+            for (int ignore = 0; ignore <= 1; ignore++) {
+                cstring_array_stream_options options = {chunk_size, ignore};
+                size_t expected_count = 0, count = 0;
+                cstring_array *expected = cstring_array_split_options(str, separators[s], separator_len, ignore, &expected_count);
+                rewind(file);
+                cstring_array *array = cstring_array_split_stream(file, separators[s], separator_len, &options, &count);
+                ASSERT(array != NULL);
+                ASSERT_EQ(count, expected_count);
+                ASSERT_EQ(array->str->n, expected->str->n);
+                ASSERT_MEM_EQ(array->str->a, expected->str->a, expected->str->n);
+                ASSERT_MEM_EQ(array->indices->a, expected->indices->a, expected->indices->n * sizeof(uint32_t));
+                cstring_array_destroy(expected);
+                cstring_array_destroy(array);
+            }
+        }
+        fclose(file);
+        free(str);
+    }
+
+    size_t count = 0;
+    FILE *file = temp_file_with(",,a,b,,");
+    cstring_array *array = cstring_array_split_stream(file, ",", 1, NULL, &count);
+    ASSERT_EQ(count, 4);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "a");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 3), "");
+    cstring_array_destroy(array);
+    fclose(file);
+    PASS();
+}
+
+typedef struct {
+    size_t batches;
+    size_t strings;
+    size_t max_batch;
+    char last[16];
+} batch_totals;
+
+static bool count_batch(cstring_array_aligned *batch, void *data) {
+    batch_totals *totals = data;
+    size_t n = cstring_array_aligned_num_strings(batch);
+    totals->batches++;
+    totals->strings += n;
+    if (n > totals->max_batch) totals->max_batch = n;
+    strncpy(totals->last, cstring_array_aligned_get_string(batch, n - 1), sizeof(totals->last) - 1);
+    return true;
+}
+
+TEST test_cstring_array_aligned_split_fd_batches(void) {
+    FILE *file = temp_file_with("w0||w1||w2||w3||w4||w5||w6");
+    cstring_array_stream_options options = {3, false};
+    batch_totals totals = {0};
+    ASSERT(cstring_array_aligned_split_fd_batches(fileno(file), "||", 2, &options, 3, count_batch, &totals));
+    ASSERT_EQ(totals.batches, 3);
+    ASSERT_EQ(totals.strings, 7);
+    ASSERT_EQ(totals.max_batch, 3);
+    ASSERT_STR_EQ(totals.last, "w6");
+    fclose(file);
+    PASS();
+}
+
+TEST test_cstring_array_frozen_get_string(void) {
+    cstring_array *array = cstring_array_new();
+    char url[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(url, sizeof(url), "https://example.com/%s/%04d", i % 2 ? "b" : "a", i);
+        cstring_array_add_string(array, url);
+    }
+    cstring_array_add_string(array, "");
+    cstring_array_sort(array);
+
+    cstring_array_frozen *frozen = cstring_array_frozen_new(array, 0);
+    ASSERT(frozen != NULL);
+    ASSERT_EQ(cstring_array_frozen_num_strings(frozen), 1001);
+    ASSERT(cstring_array_frozen_memory_size(frozen) < cstring_array_used(array));
+
+    char buf[64];
+    for (size_t i = 0; i < 1001; i++) {
+        const char *expected = cstring_array_get_string(array, i);
+        ASSERT_EQ(cstring_array_frozen_get_string(frozen, i, buf, sizeof(buf)), (int64_t)strlen(expected));
+        ASSERT_STR_EQ(buf, expected);
+    }
+    ASSERT_EQ(cstring_array_frozen_get_string(frozen, 1001, buf, sizeof(buf)), -1);
+
+    // Truncated decodes still return the full length
+    char small[8];
+    ASSERT_EQ(cstring_array_frozen_get_string(frozen, 17, small, sizeof(small)), (int64_t)strlen(cstring_array_get_string(array, 17)));
+    ASSERT_STR_EQ(small, "https:/");
+    // As does a length query with no buffer, past a block's first string too
+    ASSERT_EQ(cstring_array_frozen_get_string(frozen, 17, NULL, 0), (int64_t)strlen(cstring_array_get_string(array, 17)));
+    ASSERT_EQ(cstring_array_frozen_get_string(frozen, 0, NULL, 0), 0);
+
+    cstring_array *decoded = cstring_array_frozen_to_cstring_array(frozen);
+    ASSERT_EQ(cstring_array_num_strings(decoded), 1001);
+    ASSERT_EQ(decoded->str->n, array->str->n);
+    ASSERT_MEM_EQ(decoded->str->a, array->str->a, array->str->n);
+    ASSERT_MEM_EQ(decoded->indices->a, array->indices->a, array->indices->n * sizeof(uint32_t));
+
+    cstring_array_destroy(decoded);
+    cstring_array_frozen_destroy(frozen);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_frozen_lookup(void) {
+    char *strings[] = {"a", "ab", "abc", "abd", "abd", "b", "ba", "bab", "bb", "c", "cat", "catalog", "cats", "d"};
+    size_t n = sizeof(strings) / sizeof(strings[0]);
+    cstring_array *array = cstring_array_from_strings(strings, n);
+    for (size_t block_size = 1; block_size <= 5; block_size++) {
+        cstring_array_frozen *frozen = cstring_array_frozen_new(array, block_size);
+        for (size_t i = 0; i < n; i++) {
+            int64_t id = cstring_array_frozen_lookup(frozen, strings[i]);
+            ASSERT(id >= 0);
+            ASSERT_STR_EQ(strings[id], strings[i]);
+        }
+        char *missing[] = {"", "aa", "abe", "bac", "ca", "catb", "cb", "e"};
+        for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+            ASSERT_EQ(cstring_array_frozen_lookup(frozen, missing[i]), -1);
+        }
+        cstring_array_frozen_destroy(frozen);
+    }
+    cstring_array_destroy(array);
+
+    array = cstring_array_from_strings((char *[]){"b", "a"}, 2);
+    ASSERT(cstring_array_frozen_new(array, 0) == NULL);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_get_string_len(void) {
+    cstring_array *array = cstring_array_new();
+    size_t len = 1;
+    ASSERT(cstring_array_get_string_len(array, 0, &len) == NULL);
+    cstring_array_add_string(array, "foo");
+    cstring_array_start_token(array);
+    cstring_array_append_string(array, "ba");
+    cstring_array_cat_string(array, "rbaz");
+    ASSERT_STR_EQ(cstring_array_get_string_len(array, 1, &len), "barbaz");
+    ASSERT_EQ(len, 6);
+    ASSERT_STR_EQ(cstring_array_get_string_len(array, 0, &len), "foo");
+    ASSERT_EQ(len, 3);
+    cstring_array_add_string_len(array, "", 0);
+    cstring_array_get_string_len(array, 2, &len);
+    ASSERT_EQ(len, 0);
+    ASSERT_EQ(cstring_array_token_length(array, 1), 6);
+
+    cstring_array *copy = cstring_array_new();
+    cstring_array_extend_range(copy, array, 1, 3);
+    ASSERT_STR_EQ(cstring_array_get_string_len(copy, 0, &len), "barbaz");
+    ASSERT_EQ(len, 6);
+    cstring_array_clear(copy);
+    ASSERT_EQ(copy->indices->a[0], 0);
+    cstring_array_destroy(copy);
+    cstring_array_destroy(array);
+
+    char *str = malloc(8);
+    strcpy(str, "ab,c,de");
+    size_t count;
+    array = cstring_array_split_no_copy(str, ',', &count);
+    ASSERT_STR_EQ(cstring_array_get_string_len(array, 2, &len), "de");
+    ASSERT_EQ(len, 2);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_open_token(void) {
+    // A token that's started and appended to but never terminated
+    cstring_array *array = cstring_array_new();
+    cstring_array_start_token(array);
+    cstring_array_append_string(array, "bar");
+    size_t len;
+    ASSERT_STR_EQ(cstring_array_get_string_len(array, 0, &len), "bar");
+    ASSERT_EQ(len, 3);
+    ASSERT_EQ(cstring_array_token_length(array, 0), 3);
+    char **strings = cstring_array_to_strings(array);
+    ASSERT_STR_EQ(strings[0], "bar");
+    free(strings[0]);
+    free(strings);
+
+    // Starting the next token terminates the open one
+    array = cstring_array_new();
+    cstring_array_start_token(array);
+    cstring_array_append_string(array, "bar");
+    cstring_array_start_token(array);
+    cstring_array_append_string(array, "a");
+    cstring_array_start_token(array);
+    ASSERT_EQ(cstring_array_num_strings(array), 3);
+    ASSERT_EQ(cstring_array_token_length(array, 1), 1);
+    ASSERT_EQ(cstring_array_token_length(array, 2), 0);
+    ASSERT(cstring_array_sort(array));
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "a");
+    ASSERT_STR_EQ(cstring_array_get_string_len(array, 2, &len), "bar");
+    ASSERT_EQ(len, 3);
+    cstring_array_destroy(array);
+
+    // Writes straight to str are picked up by update_end
+    array = cstring_array_new();
+    cstring_array_add_string(array, "foo");
+    cstring_array_add_string(array, "id=");
+    char_array_cat_printf(array->str, "%d", 42);
+    ASSERT(cstring_array_update_end(array));
+    ASSERT_STR_EQ(cstring_array_get_string_len(array, 1, &len), "id=42");
+    ASSERT_EQ(len, 5);
+    ASSERT_EQ(cstring_array_token_length(array, 0), 3);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_get_string_len(void) {
+    size_t count;
+    cstring_array_aligned *array = cstring_array_aligned_split("one  three", " ", 1, &count);
+    size_t len;
+    ASSERT_STR_EQ(cstring_array_aligned_get_string_len(array, 2, &len), "three");
+    ASSERT_EQ(len, 5);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string_len(array, 1, &len), "");
+    ASSERT_EQ(len, 0);
+    ASSERT(cstring_array_aligned_get_string_len(array, 3, &len) == NULL);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_add_strings(void) {
+    cstring_array *array = cstring_array_new();
+    cstring_array_add_string(array, "first");
+    char *strings[] = {"a", "", "bcd", "efgh"};
+    ASSERT(cstring_array_add_strings(array, strings, 4));
+    ASSERT(cstring_array_add_strings(array, strings, 0));
+    ASSERT_EQ(cstring_array_num_strings(array), 5);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "a");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 2), "");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 4), "efgh");
+    ASSERT_EQ(cstring_array_token_length(array, 4), 4);
+    ASSERT_EQ(cstring_array_used(array), 6 + 2 + 1 + 4 + 5);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_add_strings_len(void) {
+    cstring_array_aligned *array = cstring_array_aligned_new();
+    char *strings[] = {"abcdef", "ghi", "jk"};
+    size_t lengths[] = {3, 0, 2};
+    ASSERT(cstring_array_aligned_add_strings_len(array, strings, lengths, 3));
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 3);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "abc");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 1), "");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 2), "jk");
+    size_t len;
+    cstring_array_aligned_get_string_len(array, 2, &len);
+    ASSERT_EQ(len, 2);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+// The byte-at-a-time split_options loop, as a reference for the vectorized splitter
+static cstring_array *reference_split(const char *str, const char *separator, bool is_set, bool ignore_consecutive) {
+    size_t len = strlen(str);
+    size_t separator_len = strlen(separator);
+    char_array *chars = char_array_new_size(len + 1);
+    bool last_was_separator = false;
+    bool first_char = false;
+    size_t i = 0;
+    while (i < len) {
+        size_t match_len = 0;
+        if (is_set) {
+            if (strchr(separator, str[i]) != NULL) match_len = 1;
+        } else if (len - i >= separator_len && memcmp(str + i, separator, separator_len) == 0) {
+            match_len = separator_len;
+        }
+        if (match_len > 0) {
+            if (first_char && (!ignore_consecutive || !last_was_separator)) {
+                char_array_push(chars, '\0');
+            }
+            i += match_len;
+            last_was_separator = true;
+        } else {
+            char_array_push(chars, str[i++]);
+            last_was_separator = false;
+            first_char = true;
+        }
+    }
+    char_array_push(chars, '\0');
+    return cstring_array_from_char_array(chars);
+}
+
+static char *random_text(size_t len, const char *alphabet, unsigned seed) {
+    char *str = malloc(len + 1);
+    size_t n = strlen(alphabet);
+    srand(seed);
+    for (size_t i = 0; i < len; i++) {
+        str[i] = alphabet[rand() % n];
+    }
+    str[len] = '\0';
+    return str;
+}
+
+TEST test_cstring_array_split_set(void) {
+    const char *sets[] = {",;\t", "ab", "abcdefgh", "\xe9\xea,;|:"};
+    const char *alphabets[] = {"xyz,;\t", "abcd", "abcdefghijklmnop", "xy\xe9\xea,;|:"};
+    for (size_t s = 0; s < 4; s++) {
+        char *str = random_text(5000, alphabets[s], (unsigned)s);
+        for (int ignore = 0; ignore <= 1; ignore++) {
+            size_t count = 0;
+            cstring_array *expected = reference_split(str, sets[s], true, ignore);
+            cstring_array *array = cstring_array_split_set_options(str, sets[s], strlen(sets[s]), ignore, &count);
+            ASSERT_EQ(count, cstring_array_num_strings(expected));
+            ASSERT_EQ(array->str->n, expected->str->n);
+            ASSERT_MEM_EQ(array->str->a, expected->str->a, expected->str->n);
+            cstring_array_destroy(expected);
+            cstring_array_destroy(array);
+        }
+        free(str);
+    }
+
+    size_t count = 0;
+    cstring_array *array = cstring_array_split_set_ignore_consecutive(",a;;b\tc", ",;\t", 3, &count);
+    ASSERT_EQ(count, 3);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "b");
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_split_separator(void) {
+    const char *separators[] = {"ab", "aab", "abcabc", "||", ","};
+    const char *alphabets[] = {"abc", "abc", "abc", "|x", "ab,,"};
+    for (size_t s = 0; s < 5; s++) {
+        char *str = random_text(5000, alphabets[s], (unsigned)s + 20);
+        for (int ignore = 0; ignore <= 1; ignore++) {
+            size_t count = 0;
+            cstring_array *expected = reference_split(str, separators[s], false, ignore);
+            cstring_array *array = cstring_array_split_options(str, separators[s], strlen(separators[s]), ignore, &count);
+            ASSERT_EQ(count, cstring_array_num_strings(expected));
+            ASSERT_EQ(array->str->n, expected->str->n);
+            ASSERT_MEM_EQ(array->str->a, expected->str->a, expected->str->n);
+            cstring_array_destroy(expected);
+            cstring_array_destroy(array);
+        }
+        free(str);
+    }
+    PASS();
+}
+
+TEST test_cstring_array_aligned_split_no_copy_set(void) {
+    char *str = malloc(16);
+    strcpy(str, "a,b;;c\td;");
+    size_t count = 0;
+    cstring_array_aligned *array = cstring_array_aligned_split_no_copy_set(str, ",;\t", 3, &count);
+    ASSERT_EQ(count, 5);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "a");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 2), "");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 3), "c");
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 4), "d");
+    ASSERT_EQ(cstring_array_aligned_token_length(array, 4), 1);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+// Reverses str and appends "!"
+static int64_t reverse_bang(const char *str, size_t len, char *out, size_t size, void *data) {
+    (void)data;
+    if (len + 1 <= size) {
+        for (size_t i = 0; i < len; i++) {
+            out[i] = str[len - 1 - i];
+        }
+        out[len] = '!';
+    }
+    return (int64_t)len + 1;
+}
+
+static bool has_even_length(const char *str, size_t len, void *data) {
+    (void)str;
+    (void)data;
+    return len % 2 == 0;
+}
+
+TEST test_cstring_array_map(void) {
+    // Big enough for several threads, with a few long strings to skew byte volume
+    char *text = random_text(400000, "abcdefghij ", 7);
+    memset(text + 1000, 'z', 100000);
+    size_t count;
+    cstring_array *array = cstring_array_split(text, " ", 1, &count);
+    for (size_t nthreads = 1; nthreads <= 4; nthreads += 3) {
+        cstring_array *mapped = cstring_array_map(array, reverse_bang, NULL, nthreads);
+        ASSERT(mapped != NULL);
+        ASSERT_EQ(cstring_array_num_strings(mapped), count);
+        ASSERT_EQ(mapped->indices->a[mapped->indices->n], mapped->str->n);
+        for (size_t i = 0; i < count; i++) {
+            size_t len, mapped_len;
+            char *str = cstring_array_get_string_len(array, i, &len);
+            char *mapped_str = cstring_array_get_string_len(mapped, i, &mapped_len);
+            ASSERT_EQ(mapped_len, len + 1);
+            ASSERT_EQ(mapped_str[len], '!');
+            for (size_t j = 0; j < len; j++) {
+                ASSERT_EQ(mapped_str[j], str[len - 1 - j]);
+            }
+        }
+        cstring_array_destroy(mapped);
+    }
+    cstring_array_destroy(array);
+    free(text);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_filter(void) {
+    char *text = random_text(300000, "abcdefg,", 9);
+    size_t count;
+    cstring_array_aligned *array = cstring_array_aligned_split(text, ",", 1, &count);
+    cstring_array_aligned *expected = cstring_array_aligned_new();
+    for (size_t i = 0; i < count; i++) {
+        size_t len;
+        char *str = cstring_array_aligned_get_string_len(array, i, &len);
+        if (len % 2 == 0) cstring_array_aligned_add_string_len(expected, str, len);
+    }
+    for (size_t nthreads = 1; nthreads <= 3; nthreads++) {
+        cstring_array_aligned *filtered = cstring_array_aligned_filter(array, has_even_length, NULL, nthreads);
+        ASSERT(filtered != NULL);
+        ASSERT_EQ(cstring_array_aligned_num_strings(filtered), cstring_array_aligned_num_strings(expected));
+        ASSERT_EQ(filtered->str->n, expected->str->n);
+        ASSERT_MEM_EQ(filtered->str->a, expected->str->a, expected->str->n);
+        ASSERT_MEM_EQ(filtered->indices->a, expected->indices->a, (expected->indices->n + 1) * sizeof(uint32_t));
+        cstring_array_aligned_destroy(filtered);
+    }
+    cstring_array_aligned_destroy(expected);
+    cstring_array_aligned_destroy(array);
+    free(text);
+    PASS();
+}
+
+TEST test_cstring_array_lower_upper(void) {
+    char *strings[] = {"Hello, World", "", "ABCDEFGHIJKLMNOPQRSTUVWXYZ@[`{ abcdefghijklmnopqrstuvwxyz", "caf\xc3\x89 MIXED case 123"};
+    cstring_array *array = cstring_array_from_strings(strings, 4);
+    cstring_array_lower(array);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "hello, world");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 2), "abcdefghijklmnopqrstuvwxyz@[`{ abcdefghijklmnopqrstuvwxyz");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 3), "caf\xc3\x89 mixed case 123");
+    cstring_array_upper(array);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "HELLO, WORLD");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 2), "ABCDEFGHIJKLMNOPQRSTUVWXYZ@[`{ ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 3), "CAF\xc3\x89 MIXED CASE 123");
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_trim(void) {
+    char *strings[] = {"  a b  ", "", " \t\n ", "x", "\r\nline\n"};
+    cstring_array_aligned *array = cstring_array_aligned_from_strings(strings, 5);
+    cstring_array_aligned_start_token(array);
+    cstring_array_aligned_append_string(array, " open ");
+    cstring_array_aligned_trim(array);
+    char *expected[] = {"a b", "", "", "x", "line", "open"};
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 6);
+    for (size_t i = 0; i < 6; i++) {
+        size_t len;
+        ASSERT_STR_EQ(cstring_array_aligned_get_string_len(array, i, &len), expected[i]);
+        ASSERT_EQ(len, strlen(expected[i]));
+    }
+    ASSERT_EQ(array->indices->a[array->indices->n], array->str->n);
+    cstring_array_aligned_destroy(array);
+
+    // A removed string is trimmed down to its terminator, and only that counts as garbage
+    array = cstring_array_aligned_from_strings((char *[]){" x ", "                padded                ", "y", "z"}, 4);
+    ASSERT(cstring_array_aligned_set_max_garbage_ratio(array, 1.0));
+    ASSERT(cstring_array_aligned_remove(array, 1));
+    cstring_array_aligned_trim(array);
+    ASSERT_EQ(array->str->n, 7);
+    ASSERT_EQ(array->removed->garbage_bytes, 1);
+    // So removing another string doesn't compact early
+    ASSERT(cstring_array_aligned_set_max_garbage_ratio(array, 0.5));
+    ASSERT(cstring_array_aligned_remove(array, 3));
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 4);
+    ASSERT_EQ(cstring_array_aligned_num_removed(array), 2);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 0), "x");
+    ASSERT(cstring_array_aligned_get_string(array, 1) == NULL);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_remove(void) {
+    char *strings[] = {"zero", "one", "two", "three", "four", "five"};
+    cstring_array *array = cstring_array_from_strings(strings, 6);
+    ASSERT(cstring_array_set_max_garbage_ratio(array, 1.0));
+    ASSERT(cstring_array_remove(array, 1));
+    ASSERT(!cstring_array_remove(array, 1));
+    ASSERT(!cstring_array_remove(array, 6));
+    ASSERT(cstring_array_remove(array, 4));
+    ASSERT_EQ(cstring_array_num_removed(array), 2);
+    // Nothing moves until compact
+    ASSERT_EQ(cstring_array_num_strings(array), 6);
+    ASSERT(cstring_array_get_string(array, 1) == NULL);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 2), "two");
+
+    cstring_array *other = cstring_array_new();
+    cstring_array_extend(other, array);
+    ASSERT_EQ(cstring_array_num_strings(other), 4);
+    ASSERT_STR_EQ(cstring_array_get_string(other, 1), "two");
+    ASSERT_STR_EQ(cstring_array_get_string(other, 3), "five");
+    cstring_array_destroy(other);
+
+    cstring_array_compact(array);
+    ASSERT_EQ(cstring_array_num_removed(array), 0);
+    char *expected[] = {"zero", "two", "three", "five"};
+    ASSERT_EQ(cstring_array_num_strings(array), 4);
+    for (size_t i = 0; i < 4; i++) {
+        size_t len;
+        ASSERT_STR_EQ(cstring_array_get_string_len(array, i, &len), expected[i]);
+        ASSERT_EQ(len, strlen(expected[i]));
+    }
+    ASSERT_EQ(array->str->n, strlen("zero two three five") + 1);
+    ASSERT_EQ(array->indices->a[array->indices->n], array->str->n);
+
+    // Removing half the bytes with the default ratio compacts automatically
+    cstring_array_set_max_garbage_ratio(array, CSTRING_ARRAY_DEFAULT_GARBAGE_RATIO);
+    ASSERT(cstring_array_remove(array, 0));
+    ASSERT_EQ(cstring_array_num_strings(array), 4);
+    ASSERT(cstring_array_remove(array, 2));
+    ASSERT_EQ(cstring_array_num_strings(array), 2);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 0), "two");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "five");
+    cstring_array_destroy(array);
+    PASS();
+}
+
+static bool is_odd_number(const char *str, size_t len, void *data) {
+    (void)data;
+    return len > 0 && (str[len - 1] - '0') % 2 == 1;
+}
+
+TEST test_cstring_array_aligned_remove_if(void) {
+    cstring_array_aligned *array = cstring_array_aligned_new();
+    char buf[16];
+    for (size_t i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "%zu", i);
+        cstring_array_aligned_add_string(array, buf);
+    }
+    cstring_array_aligned_set_max_garbage_ratio(array, 1.0);
+    ASSERT_EQ(cstring_array_aligned_remove_if(array, is_odd_number, NULL), 500);
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 1000);
+    ASSERT(cstring_array_aligned_get_string(array, 999) == NULL);
+
+    cstring_array_aligned *evens = cstring_array_aligned_map(array, reverse_bang, NULL, 1);
+    ASSERT_EQ(cstring_array_aligned_num_strings(evens), 500);
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(evens, 5), "01!");
+    cstring_array_aligned_destroy(evens);
+
+    // An empty ratio compacts on the next removal
+    cstring_array_aligned_set_max_garbage_ratio(array, 0.0);
+    ASSERT_EQ(cstring_array_aligned_remove_if(array, has_even_length, NULL), 45);
+    ASSERT_EQ(cstring_array_aligned_num_removed(array), 0);
+    ASSERT_EQ(cstring_array_aligned_num_strings(array), 455);
+    for (size_t i = 0; i < 455; i++) {
+        size_t len;
+        char *str = cstring_array_aligned_get_string_len(array, i, &len);
+        ASSERT(len % 2 == 1);
+        ASSERT((str[len - 1] - '0') % 2 == 0);
+    }
+    ASSERT_STR_EQ(cstring_array_aligned_get_string(array, 5), "100");
+    ASSERT_EQ(array->indices->a[array->indices->n], array->str->n);
+    cstring_array_aligned_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_aligned_new_hugepage(void) {
+    for (int hugetlb = 0; hugetlb <= 1; hugetlb++) {
+        cstring_array_hugepage_allocator allocator;
+        cstring_array_hugepage_allocator_init(&allocator, 4096);
+        // MAP_HUGETLB usually fails without reserved pages and falls back to a regular mapping
+        allocator.use_hugetlb = hugetlb;
+        allocator.populate = hugetlb;
+        cstring_array_aligned *array = cstring_array_aligned_new_hugepage(&allocator, 16, 64);
+        ASSERT(array != NULL);
+        char buf[32];
+        for (size_t i = 0; i < 50000; i++) {
+            snprintf(buf, sizeof(buf), "string %zu", i);
+            ASSERT(cstring_array_aligned_add_string(array, buf) != UINT32_MAX);
+        }
+#ifdef CSTRING_ARRAY_HAVE_HUGEPAGES
+        // Both buffers are past the threshold by now, so they're mappings
+        ASSERT_EQ((uintptr_t)array->str->a % 4096, 0);
+        ASSERT_EQ((uintptr_t)array->indices->a % 4096, 0);
+#endif
+        ASSERT_EQ((uintptr_t)array->str % 64, 0);
+        for (size_t i = 0; i < 50000; i += 997) {
+            snprintf(buf, sizeof(buf), "string %zu", i);
+            ASSERT_STR_EQ(cstring_array_aligned_get_string(array, i), buf);
+        }
+        ASSERT_EQ(array->indices->a[array->indices->n], array->str->n);
+        cstring_array_aligned_destroy(array);
+    }
+    PASS();
+}
+
+TEST test_cstring_array_shrink_to_fit(void) {
+    cstring_array *array = cstring_array_new_size(4096);
+    cstring_array_add_string(array, "foo");
+    cstring_array_add_string(array, "bar");
+    size_t reclaimed = cstring_array_shrink_to_fit(array);
+    ASSERT(reclaimed >= 4096 - 8);
+    ASSERT_EQ(array->str->m, 8);
+    ASSERT_EQ(array->indices->m, 3);
+    ASSERT_STR_EQ(cstring_array_get_string(array, 1), "bar");
+    ASSERT_EQ(cstring_array_shrink_to_fit(array), 0);
+    // Still growable afterwards
+    cstring_array_add_string(array, "baz");
+    ASSERT_STR_EQ(cstring_array_get_string(array, 2), "baz");
+    ASSERT_EQ(array->indices->a[array->indices->n], array->str->n);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+#ifdef CSTRING_ARRAY_STATS
+TEST test_cstring_array_stats(void) {
+    cstring_array_stats_reset();
+    cstring_array *array = cstring_array_new_size(1);
+    for (size_t i = 0; i < 1000; i++) {
+        cstring_array_add_string(array, "abcd");
+    }
+    cstring_array_statistics stats = cstring_array_stats();
+    ASSERT_EQ(stats.strings_added, 1000);
+    ASSERT_EQ(stats.bytes_added, 5000);
+    ASSERT(stats.str_reallocs > 0 && stats.str_reallocs < 20);
+    ASSERT(stats.indices_reallocs > 0 && stats.indices_reallocs < 20);
+    cstring_array_destroy(array);
+
+    size_t count;
+    array = cstring_array_split("a,b,c", ",", 1, &count);
+    cstring_array_destroy(array);
+    // split_no_copy takes ownership of the string
+    char *text = malloc(4);
+    memcpy(text, "d e", 4);
+    array = cstring_array_split_no_copy(text, ' ', &count);
+    cstring_array_destroy(array);
+    stats = cstring_array_stats();
+    ASSERT_EQ(stats.split_calls, 2);
+    ASSERT_EQ(stats.split_strings, 5);
+
+    FILE *file = tmpfile();
+    cstring_array_stats_dump(file);
+    ASSERT(ftell(file) > 0);
+    fclose(file);
+    PASS();
+}
+#endif
+
+TEST test_cstring_array_small_inline(void) {
+    cstring_array_small_inline storage;
+    cstring_array_small *array = cstring_array_small_inline_init(&storage);
+    ASSERT_EQ(cstring_array_small_num_strings(array), 0);
+    cstring_array_small_add_string(array, "GET");
+    cstring_array_small_add_string(array, "/index.html");
+    cstring_array_small_add_string(array, "HTTP/1.1");
+    ASSERT(cstring_array_small_inline_is_inline(&storage));
+    ASSERT_STR_EQ(cstring_array_small_get_string(array, 1), "/index.html");
+
+    // Past the inline offsets and bytes, both spill to the heap
+    char str[32];
+    for (size_t i = 0; i < 100; i++) {
+        snprintf(str, sizeof(str), "field%zu", i);
+        ASSERT_EQ(cstring_array_small_add_string(array, str), cstring_array_small_used(array) - strlen(str) - 1);
+    }
+    ASSERT(!cstring_array_small_inline_is_inline(&storage));
+    ASSERT_EQ(cstring_array_small_num_strings(array), 103);
+    ASSERT_STR_EQ(cstring_array_small_get_string(array, 0), "GET");
+    ASSERT_STR_EQ(cstring_array_small_get_string(array, 102), "field99");
+    cstring_array_small_destroy(array);
+
+    // The storage is reusable once destroyed
+    array = cstring_array_small_inline_init(&storage);
+    cstring_array_small_add_string(array, "a");
+    ASSERT_EQ(cstring_array_small_num_strings(array), 1);
+    cstring_array_small_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_small_offsets(void) {
+    size_t count;
+    cstring_array_small *array = cstring_array_small_split("a,bb,,ccc,dddd,e,ff,g,hh,i", ",", 1, &count);
+    ASSERT_EQ(count, 10);
+    ASSERT_EQ(sizeof(array->indices->a[0]), 2);
+
+    // extend rebases the 16-bit offsets
+    cstring_array_small *other = cstring_array_small_new();
+    cstring_array_small_add_string(other, "x");
+    ASSERT(cstring_array_small_extend(other, array));
+    ASSERT_EQ(cstring_array_small_num_strings(other), 11);
+    ASSERT_STR_EQ(cstring_array_small_get_string(other, 10), "i");
+    ASSERT_STR_EQ(cstring_array_small_get_string(other, 4), "ccc");
+    ASSERT_EQ(other->indices->a[other->indices->n], other->str->n);
+
+    // Adds that would overflow the 64 KiB pool fail and leave the array as it was
+    char *big = malloc(UINT16_MAX);
+    ASSERT(big != NULL);
+    memset(big, 'x', UINT16_MAX);
+    size_t used = cstring_array_small_used(other);
+    ASSERT_EQ(cstring_array_small_add_string_len(other, big, UINT16_MAX - used), UINT16_MAX);
+    ASSERT_EQ(cstring_array_small_used(other), used);
+    ASSERT_EQ(cstring_array_small_num_strings(other), 11);
+    ASSERT(cstring_array_small_add_string_len(other, big, UINT16_MAX - used - 2) != UINT16_MAX);
+    ASSERT_EQ(cstring_array_small_num_strings(other), 12);
+    free(big);
+
+    // So do splits of inputs past 64 KiB, rather than wrapping their offsets
+    char *text = malloc(70001);
+    ASSERT(text != NULL);
+    for (size_t i = 0; i < 70000; i++) {
+        text[i] = i % 1000 == 999 ? ',' : 'x';
+    }
+    text[70000] = '\0';
+    ASSERT(cstring_array_small_split(text, ",", 1, &count) == NULL);
+    ASSERT(cstring_array_small_split_no_copy_set(text, ",;", 2, &count) == NULL);
+    ASSERT(cstring_array_small_split_no_copy(text, ',', &count) == NULL);
+    // Nothing was split in place
+    ASSERT_EQ(text[999], ',');
+    text[60500] = '\0';
+    cstring_array_small *fits = cstring_array_small_split_no_copy(text, ',', &count);
+    ASSERT(fits != NULL);
+    ASSERT_EQ(count, 61);
+    ASSERT_EQ(fits->indices->a[60], 60000);
+    // fits owns text now
+    cstring_array_small_destroy(fits);
+
+    cstring_array_small_destroy(other);
+    cstring_array_small_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_trie(void) {
+    char *strings[] = {"cats", "a", "catalog", "abd", "ab", "cat", "abd", "b", "bab", "abc", "", "d"};
+    size_t n = sizeof(strings) / sizeof(strings[0]);
+    cstring_array *array = cstring_array_from_strings(strings, n);
+    cstring_array_trie *trie = cstring_array_trie_new(array);
+    ASSERT(trie != NULL);
+    ASSERT_EQ(cstring_array_trie_num_strings(trie), n);
+
+    for (size_t i = 0; i < n; i++) {
+        int64_t id = cstring_array_trie_lookup(trie, strings[i]);
+        ASSERT(id >= 0);
+        ASSERT_STR_EQ(strings[id], strings[i]);
+    }
+    // Duplicates resolve to the first id
+    ASSERT_EQ(cstring_array_trie_lookup(trie, "abd"), 3);
+    char *missing[] = {"aa", "abe", "abdx", "ba", "ca", "catb", "catalo", "e"};
+    for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+        ASSERT_EQ(cstring_array_trie_lookup(trie, missing[i]), -1);
+    }
+
+    // Prefix matches come back in sorted order, including ones ending inside an edge
+    const uint32_t *ids;
+    ASSERT_EQ(cstring_array_trie_prefix(trie, "ca", &ids), 3);
+    ASSERT_STR_EQ(strings[ids[0]], "cat");
+    ASSERT_STR_EQ(strings[ids[1]], "catalog");
+    ASSERT_STR_EQ(strings[ids[2]], "cats");
+    ASSERT_EQ(cstring_array_trie_prefix(trie, "ab", &ids), 4);
+    ASSERT_EQ(cstring_array_trie_prefix(trie, "catalogs", &ids), 0);
+    ASSERT_EQ(cstring_array_trie_prefix(trie, "", &ids), n);
+
+    size_t match_len;
+    ASSERT_EQ(cstring_array_trie_longest_prefix(trie, "catalogue", &match_len), 2);
+    ASSERT_EQ(match_len, 7);
+    ASSERT_EQ(cstring_array_trie_longest_prefix(trie, "catapult", &match_len), 5);
+    ASSERT_EQ(match_len, 3);
+    ASSERT_EQ(cstring_array_trie_longest_prefix(trie, "xyz", &match_len), 10);
+    ASSERT_EQ(match_len, 0);
+
+    const char *path = "test_cstring_array_trie.bin";
+    ASSERT(cstring_array_trie_save(trie, path));
+    cstring_array_trie *loaded = cstring_array_trie_load(path);
+    ASSERT(loaded != NULL);
+    ASSERT_EQ(cstring_array_trie_lookup(loaded, "catalog"), 2);
+    ASSERT_EQ(cstring_array_trie_prefix(loaded, "b", &ids), 2);
+    cstring_array_trie_destroy(loaded);
+
+    // A flipped byte fails the checksum
+    FILE *f = fopen(path, "r+b");
+    ASSERT(f != NULL);
+    fseek(f, -1, SEEK_END);
+    fputc(0x7f, f);
+    fclose(f);
+    ASSERT_EQ(cstring_array_trie_load(path), NULL);
+
+    // Ids past the end of the array are rejected even with a matching checksum
+    uint32_t id = trie->ids[0];
+    trie->ids[0] = (uint32_t)n;
+    ASSERT(cstring_array_trie_save(trie, path));
+    ASSERT_EQ(cstring_array_trie_load(path), NULL);
+    trie->ids[0] = id;
+    remove(path);
+
+    cstring_array_trie_destroy(trie);
+
+    // An empty array, or one with every string removed, builds an empty trie
+    ASSERT(cstring_array_set_max_garbage_ratio(array, 1.0));
+    for (size_t i = 0; i < n; i++) {
+        ASSERT(cstring_array_remove(array, i));
+    }
+    trie = cstring_array_trie_new(array);
+    ASSERT(trie != NULL);
+    ASSERT_EQ(cstring_array_trie_num_strings(trie), 0);
+    ASSERT_EQ(cstring_array_trie_lookup(trie, ""), -1);
+    ASSERT_EQ(cstring_array_trie_prefix(trie, "", &ids), 0);
+    cstring_array_trie_destroy(trie);
+    cstring_array_destroy(array);
+
+    array = cstring_array_new();
+    trie = cstring_array_trie_new(array);
+    ASSERT(trie != NULL);
+    ASSERT_EQ(cstring_array_trie_lookup(trie, "a"), -1);
+    cstring_array_trie_destroy(trie);
+    cstring_array_destroy(array);
+    PASS();
+}
+
+TEST test_cstring_array_split_records(void) {
+    const char *tsv = "GET\t/\t200\t512\nPOST\t/login\t302\n\nGET\t/favicon.ico\t404\t0\textra\n";
+    cstring_array *methods = cstring_array_new();
+    cstring_array *statuses = cstring_array_new();
+    cstring_array *sizes = cstring_array_new();
+    // The path column is projected out
+    cstring_array *columns[] = {methods, NULL, statuses, sizes};
+    size_t num_records;
+    ASSERT(cstring_array_split_records(tsv, strlen(tsv), '\t', '\n', columns, 4, &num_records));
+    ASSERT_EQ(num_records, 4);
+    ASSERT_EQ(cstring_array_num_strings(methods), 4);
+    ASSERT_EQ(cstring_array_num_strings(statuses), 4);
+    ASSERT_EQ(cstring_array_num_strings(sizes), 4);
+    ASSERT_STR_EQ(cstring_array_get_string(methods, 1), "POST");
+    ASSERT_STR_EQ(cstring_array_get_string(statuses, 1), "302");
+    // Short and empty records are padded with empty fields
+    ASSERT_STR_EQ(cstring_array_get_string(sizes, 1), "");
+    ASSERT_STR_EQ(cstring_array_get_string(methods, 2), "");
+    ASSERT_STR_EQ(cstring_array_get_string(statuses, 3), "404");
+    ASSERT_STR_EQ(cstring_array_get_string(sizes, 3), "0");
+
+    // Appends, and the last record needs no trailing separator
+    ASSERT(cstring_array_split_records("PUT\t/x\t201", 11, '\t', '\n', columns, 4, &num_records));
+    ASSERT_EQ(num_records, 1);
+    ASSERT_STR_EQ(cstring_array_get_string(methods, 4), "PUT");
+    ASSERT_STR_EQ(cstring_array_get_string(statuses, 4), "201");
+    ASSERT_STR_EQ(cstring_array_get_string(sizes, 4), "");
+    ASSERT(!cstring_array_split_records("a", 1, ',', ',', columns, 4, &num_records));
+
+    // Records spanning several scan blocks, checked against split
+    char csv[4096];
+    size_t len = 0;
+    for (int i = 0; i < 200; i++) {
+        len += (size_t)sprintf(csv + len, "%d,name%d,%d\r", i, i * 7, i % 3);
+    }
+    cstring_array *ids = cstring_array_new();
+    cstring_array *names = cstring_array_new();
+    cstring_array *csv_columns[] = {ids, names};
+    ASSERT(cstring_array_split_records(csv + 1, len - 1, ',', '\r', csv_columns, 2, &num_records));
+    ASSERT_EQ(num_records, 200);
+    ASSERT_STR_EQ(cstring_array_get_string(ids, 0), "");
+    ASSERT_STR_EQ(cstring_array_get_string(ids, 1), "1");
+    ASSERT_STR_EQ(cstring_array_get_string(names, 199), "name1393");
+
+    // An unterminated heap buffer of exactly len bytes is never read past
+    char *exact = malloc(70);
+    memcpy(exact, csv + 3, 70);
+    ASSERT(cstring_array_split_records(exact, 70, ',', '\r', csv_columns, 2, &num_records));
+    ASSERT_EQ(num_records, 7);
+    free(exact);
+
+    cstring_array_destroy(ids);
+    cstring_array_destroy(names);
+    cstring_array_destroy(methods);
+    cstring_array_destroy(statuses);
+    cstring_array_destroy(sizes);
+    PASS();
+}
+
+TEST test_cstring_array_intersect(void) {
+    size_t count;
+    cstring_array *a = cstring_array_split("the cat and the hat", " ", 1, &count);
+    cstring_array *b = cstring_array_split("hat the dog the", " ", 1, &count);
+    cstring_array *c = cstring_array_split("the cat and the hat", " ", 1, &count);
+
+    ASSERT(cstring_array_equals(a, c));
+    ASSERT(!cstring_array_equals(a, b));
+    // Same strings, different layout once one is removed
+    cstring_array_add_string(c, "dog");
+    ASSERT(!cstring_array_equals(a, c));
+    ASSERT(cstring_array_remove(c, 5));
+    ASSERT(cstring_array_equals(a, c));
+    ASSERT(cstring_array_remove(c, 0));
+    ASSERT(!cstring_array_equals(a, c));
+
+    // Duplicates on both sides give every pair, sorted
+    cstring_array_index_pair *pairs = cstring_array_intersect(a, b, 1, &count);
+    ASSERT(pairs != NULL);
+    ASSERT_EQ(count, 5);
+    size_t expected[5][2] = {{0, 1}, {0, 3}, {3, 1}, {3, 3}, {4, 0}};
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(pairs[i].a, expected[i][0]);
+        ASSERT_EQ(pairs[i].b, expected[i][1]);
+    }
+    free(pairs);
+
+    size_t *ids = cstring_array_diff(a, b, 1, &count);
+    ASSERT(ids != NULL);
+    ASSERT_EQ(count, 2);
+    ASSERT_EQ(ids[0], 1);
+    ASSERT_EQ(ids[1], 2);
+    free(ids);
+    // Removed strings match nothing
+    ASSERT(cstring_array_remove(b, 0));
+    ids = cstring_array_diff(a, b, 1, &count);
+    ASSERT_EQ(count, 3);
+    ASSERT_EQ(ids[2], 4);
+    free(ids);
+
+    // Large enough to be split across threads
+    cstring_array *words = cstring_array_new();
+    cstring_array *evens = cstring_array_new();
+    char buf[32];
+    for (int i = 0; i < 50000; i++) {
+        sprintf(buf, "word%d", i);
+        cstring_array_add_string(words, buf);
+        if (i % 2 == 0) cstring_array_add_string(evens, buf);
+    }
+    pairs = cstring_array_intersect(words, evens, 4, &count);
+    ASSERT_EQ(count, 25000);
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(pairs[i].a, 2 * i);
+        ASSERT_EQ(pairs[i].b, i);
+    }
+    free(pairs);
+    ids = cstring_array_diff(words, evens, 4, &count);
+    ASSERT_EQ(count, 25000);
+    ASSERT_EQ(ids[0], 1);
+    ASSERT_EQ(ids[24999], 49999);
+    free(ids);
+
+    cstring_array_destroy(words);
+    cstring_array_destroy(evens);
+    cstring_array_destroy(a);
+    cstring_array_destroy(b);
+    cstring_array_destroy(c);
+    PASS();
+}
+
+// Every token of the iterator against split_options, on a copy so str needn't be terminated
+static bool split_iter_matches_split(const char *str, size_t len, const char *separator, bool ignore_consecutive) {
+    char *copy = malloc(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    size_t count;
+    cstring_array *array = cstring_array_split_options(copy, separator, strlen(separator), ignore_consecutive, &count);
+
+    cstring_array_split_iter iter;
+    cstring_array_split_iter_init(&iter, str, len, separator, strlen(separator), ignore_consecutive);
+    const char *token;
+    size_t token_len;
+    size_t i = 0;
+    bool ok = true;
+    while (ok && cstring_array_split_iter_next(&iter, &token, &token_len)) {
+        size_t expected_len;
+        char *expected = cstring_array_get_string_len(array, i++, &expected_len);
+        ok = expected != NULL && token_len == expected_len && memcmp(token, expected, token_len) == 0 && token >= str && token + token_len <= str + len;
+    }
+    ok = ok && i == count && !cstring_array_split_iter_next(&iter, &token, &token_len);
+    cstring_array_destroy(array);
+    free(copy);
+    return ok;
+}
+
+TEST test_cstring_array_split_iter(void) {
+    const char *inputs[] = {"", ",", ",,a,,b,", "a", "a,b,,c", "a,,", ",,,", "a, b,, c , "};
+    for (size_t k = 0; k < sizeof(inputs) / sizeof(inputs[0]); k++) {
+        ASSERT(split_iter_matches_split(inputs[k], strlen(inputs[k]), ",", false));
+        ASSERT(split_iter_matches_split(inputs[k], strlen(inputs[k]), ",", true));
+        ASSERT(split_iter_matches_split(inputs[k], strlen(inputs[k]), ", ", false));
+        ASSERT(split_iter_matches_split(inputs[k], strlen(inputs[k]), ", ", true));
+    }
+
+    // Spanning several scan blocks, at every alignment
+    char text[512];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = (i * 7) % 11 < 3 ? ',' : (char)('a' + i % 26);
+    }
+    for (size_t start = 0; start < 64; start += 7) {
+        ASSERT(split_iter_matches_split(text + start, sizeof(text) - start - 3, ",", false));
+        ASSERT(split_iter_matches_split(text + start, sizeof(text) - start - 3, ",", true));
+    }
+    // An unterminated heap buffer of exactly len bytes is never read past
+    char *exact = malloc(100);
+    memcpy(exact, text + 5, 100);
+    ASSERT(split_iter_matches_split(exact, 100, ",", false));
+    free(exact);
+
+    // Early exit reads just the first field, and tokens point into the input
+    const char *header = "Content-Type: text/html; charset=utf-8";
+    cstring_array_split_iter iter;
+    cstring_array_split_iter_init(&iter, header, strlen(header), ": ", 2, false);
+    const char *token;
+    size_t token_len;
+    ASSERT(cstring_array_split_iter_next(&iter, &token, &token_len));
+    ASSERT(token == header);
+    ASSERT_EQ(token_len, 12);
+
+    cstring_array_split_iter_init_set(&iter, header, strlen(header), ":;= ", 4, true);
+    const char *fields[] = {"Content-Type", "text/html", "charset", "utf-8"};
+    for (size_t i = 0; i < 4; i++) {
+        ASSERT(cstring_array_split_iter_next(&iter, &token, &token_len));
+        ASSERT_EQ(token_len, strlen(fields[i]));
+        ASSERT(memcmp(token, fields[i], token_len) == 0);
+    }
+    ASSERT(!cstring_array_split_iter_next(&iter, &token, &token_len));
+    PASS();
+}
+
+#ifdef CSTRING_ARRAY_HAVE_THREADS
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_STRINGS 5000
+
+typedef struct {
+    cstring_array_concurrent *shared;
+    size_t thread;
+    bool use_writer;
+    // Ids returned by the direct adds
+    uint64_t *ids;
+} concurrent_job;
+
+static void *concurrent_add(void *arg) {
+    concurrent_job *job = arg;
+    cstring_array_concurrent_writer writer = {NULL, NULL};
+    if (job->use_writer) cstring_array_concurrent_writer_init(&writer, job->shared);
+    char buf[64];
+    for (size_t i = 0; i < CONCURRENT_STRINGS; i++) {
+        // Lengths vary so that strings straddle segment boundaries
+        snprintf(buf, sizeof(buf), "%zu-%zu-%.*s", job->thread, i, (int)(i % 17), "xxxxxxxxxxxxxxxxx");
+        if (job->use_writer) {
+            cstring_array_concurrent_writer_add_string(&writer, buf);
+        } else {
+            job->ids[i] = cstring_array_concurrent_add_string(job->shared, buf);
+        }
+    }
+    if (job->use_writer) cstring_array_concurrent_writer_destroy(&writer);
+    return NULL;
+}
+
+TEST test_cstring_array_concurrent(void) {
+    cstring_array_concurrent *shared = cstring_array_concurrent_new_size(61);
+    ASSERT(shared != NULL);
+    // Segment tables are allocated as they're used, not up front
+    ASSERT(sizeof(cstring_array_concurrent) < 8192);
+    pthread_t threads[CONCURRENT_THREADS];
+    concurrent_job jobs[CONCURRENT_THREADS];
+    for (size_t t = 0; t < CONCURRENT_THREADS; t++) {
+        jobs[t] = (concurrent_job){shared, t, t % 2 == 1, malloc(CONCURRENT_STRINGS * sizeof(uint64_t))};
+        ASSERT_EQ(pthread_create(&threads[t], NULL, concurrent_add, &jobs[t]), 0);
+    }
+    for (size_t t = 0; t < CONCURRENT_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    ASSERT_EQ(cstring_array_concurrent_num_strings(shared), CONCURRENT_THREADS * CONCURRENT_STRINGS);
+
+    cstring_array *array = cstring_array_concurrent_finalize(shared);
+    ASSERT(array != NULL);
+    ASSERT_EQ(cstring_array_num_strings(array), CONCURRENT_THREADS * CONCURRENT_STRINGS);
+    ASSERT_EQ(array->indices->a[array->indices->n], array->str->n);
+
+    char buf[64];
+    size_t next[CONCURRENT_THREADS] = {0};
+    for (size_t i = 0; i < cstring_array_num_strings(array); i++) {
+        size_t thread, j, len;
+        char *str = cstring_array_get_string_len(array, i, &len);
+        ASSERT_EQ(strlen(str), len);
+        ASSERT_EQ(sscanf(str, "%zu-%zu-", &thread, &j), 2);
+        ASSERT(thread < CONCURRENT_THREADS);
+        snprintf(buf, sizeof(buf), "%zu-%zu-%.*s", thread, j, (int)(j % 17), "xxxxxxxxxxxxxxxxx");
+        ASSERT_STR_EQ(str, buf);
+        if (jobs[thread].use_writer) {
+            // Each writer's strings keep their order
+            ASSERT_EQ(j, next[thread]);
+            next[thread]++;
+        } else {
+            ASSERT_EQ(jobs[thread].ids[j], i);
+        }
+    }
+    for (size_t t = 0; t < CONCURRENT_THREADS; t++) {
+        if (jobs[t].use_writer) ASSERT_EQ(next[t], CONCURRENT_STRINGS);
+        free(jobs[t].ids);
+    }
+    cstring_array_destroy(array);
+    cstring_array_concurrent_destroy(shared);
+    PASS();
+}
+#endif
+
 SUITE(cstring_array_suite) {
     RUN_TEST(test_cstring_array_new);
     RUN_TEST(test_cstring_array_aligned_new);
@@ -319,6 +1880,59 @@ SUITE(cstring_array_suite) {
     RUN_TEST(test_cstring_array_aligned_from_char_array);
     RUN_TEST(test_cstring_array_from_strings);
     RUN_TEST(test_cstring_array_aligned_from_strings);
+    RUN_TEST(test_cstring_array_from_char_array_long);
+    RUN_TEST(test_cstring_array_aligned_from_char_array_long);
+    RUN_TEST(test_cstring_array_split_no_copy);
+    RUN_TEST(test_cstring_array_aligned_split_no_copy);
+    RUN_TEST(test_cstring_array64_new);
+    RUN_TEST(test_cstring_array64_add_string);
+    RUN_TEST(test_cstring_array64_from_strings);
+    RUN_TEST(test_cstring_array_save_mmap_open);
+    RUN_TEST(test_cstring_array64_save_mmap_open);
+    RUN_TEST(test_cstring_array_split_parallel);
+    RUN_TEST(test_cstring_array_aligned_split_parallel);
+    RUN_TEST(test_cstring_array_extend);
+    RUN_TEST(test_cstring_array_aligned_extend_range);
+    RUN_TEST(test_cstring_array_interned_add_string);
+    RUN_TEST(test_cstring_array_interned_lookup);
+    RUN_TEST(test_cstring_array_sort);
+    RUN_TEST(test_cstring_array_aligned_bsearch);
+    RUN_TEST(test_cstring_array_view);
+    RUN_TEST(test_cstring_array_aligned_to_strings_borrowed);
+    RUN_TEST(test_cstring_array_new_arena);
+    RUN_TEST(test_cstring_array_aligned_new_arena);
+    RUN_TEST(test_cstring_array_split_stream);
+    RUN_TEST(test_cstring_array_aligned_split_fd_batches);
+    RUN_TEST(test_cstring_array_frozen_get_string);
+    RUN_TEST(test_cstring_array_frozen_lookup);
+    RUN_TEST(test_cstring_array_get_string_len);
+    RUN_TEST(test_cstring_array_open_token);
+    RUN_TEST(test_cstring_array_aligned_get_string_len);
+    RUN_TEST(test_cstring_array_add_strings);
+    RUN_TEST(test_cstring_array_aligned_add_strings_len);
+    RUN_TEST(test_cstring_array_split_set);
+    RUN_TEST(test_cstring_array_split_separator);
+    RUN_TEST(test_cstring_array_aligned_split_no_copy_set);
+    RUN_TEST(test_cstring_array_map);
+    RUN_TEST(test_cstring_array_aligned_filter);
+    RUN_TEST(test_cstring_array_lower_upper);
+    RUN_TEST(test_cstring_array_aligned_trim);
+    RUN_TEST(test_cstring_array_remove);
+    RUN_TEST(test_cstring_array_aligned_remove_if);
+    RUN_TEST(test_cstring_array_aligned_new_hugepage);
+    RUN_TEST(test_cstring_array_shrink_to_fit);
+#ifdef CSTRING_ARRAY_STATS
+    RUN_TEST(test_cstring_array_stats);
+#endif
+#ifdef CSTRING_ARRAY_HAVE_THREADS
+    RUN_TEST(test_cstring_array_concurrent);
+#endif
+    RUN_TEST(test_cstring_array_small_inline);
+    RUN_TEST(test_cstring_array_small_offsets);
+    RUN_TEST(test_cstring_array_trie);
+    RUN_TEST(test_cstring_array_split_records);
+    RUN_TEST(test_cstring_array_intersect);
+    RUN_TEST(test_cstring_array_split_iter);
 }
 
 GREATEST_MAIN_DEFS();